@@ -718,6 +718,127 @@ trace_line(char * tag, int n, const char * s, int len)
 #define trace_line(tag, n, s, len)	
 #endif
 
+/*
+   Outbound queue for input to the child process.
+   pty_fd is non-blocking, so whatever the pty does not take right away 
+   is kept here and sent when select() reports the pty writable; 
+   further writes are appended behind it (coalescing small writes) 
+   in order to keep the byte order.
+ */
+#define WRITEMAX 4096
+
+static struct {
+  char * buf;
+  uint start, len, size;
+  uint peak;	// queued bytes high-water mark
+} outq;
+
+uint
+child_queued(uint * peak)
+{
+  if (peak)
+    *peak = outq.peak;
+  return outq.len;
+}
+
+static void
+outq_clear(void)
+{
+  free(outq.buf);
+  outq.buf = 0;
+  outq.start = outq.len = outq.size = 0;
+}
+
+// Write as much as the pty takes; return the number of bytes written,
+// or -1 if the pty failed.
+static int
+pty_write(const char * buf, uint len)
+{
+  uint done = 0;
+  while (done < len) {
+    int n = write(pty_fd, buf + done, min(len - done, WRITEMAX));
+    trace_line("cwrt", n, buf + done, n > 0 ? n : 0);
+    if (n > 0)
+      done += n;
+    else if (n < 0 && errno == EINTR)
+      continue;
+    else if (n < 0 && errno != EAGAIN)
+      return -1;
+    else
+      break;
+  }
+  return done;
+}
+
+// Write all of buf, waiting for the pty to become writable as needed.
+static void
+pty_write_all(const char * buf, uint len)
+{
+  while (len) {
+    fd_set wfds;
+    FD_ZERO(&wfds);
+    FD_SET(pty_fd, &wfds);
+    if (select(pty_fd + 1, 0, &wfds, 0, 0) < 0 && errno != EINTR)
+      return;
+    int n = pty_write(buf, len);
+    if (n < 0)
+      return;
+    buf += n;
+    len -= n;
+  }
+}
+
+static void
+outq_append(const char * buf, uint len)
+{
+  if (outq.start + outq.len + len > outq.size) {
+    if (outq.start) {
+      memmove(outq.buf, outq.buf + outq.start, outq.len);
+      outq.start = 0;
+    }
+    if (outq.len + len > outq.size) {
+      uint size = max(max(outq.size * 2, outq.len + len), WRITEMAX);
+      char * newbuf = renewn(outq.buf, size);
+      if (!newbuf && size > outq.len + len) {
+        size = outq.len + len;
+        newbuf = renewn(outq.buf, size);
+      }
+      if (!newbuf) {
+        // out of memory: rather than losing input, 
+        // wait for the pty to take the queue and the new data
+        pty_write_all(outq.buf + outq.start, outq.len);
+        outq.start = outq.len = 0;
+        pty_write_all(buf, len);
+        return;
+      }
+      outq.buf = newbuf;
+      outq.size = size;
+    }
+  }
+  memcpy(outq.buf + outq.start + outq.len, buf, len);
+  outq.len += len;
+  if (outq.len > outq.peak) {
+    outq.peak = outq.len;
+#ifdef debug_pty
+    printf("cwrt queued %u (peak)\n", outq.peak);
+#endif
+  }
+}
+
+static void
+outq_flush(void)
+{
+  int n = pty_write(outq.buf + outq.start, outq.len);
+  if (n < 0)
+    outq_clear();
+  else if ((uint)n == outq.len)
+    outq.start = outq.len = 0;
+  else {
+    outq.start += n;
+    outq.len -= n;
+  }
+}
+
 void
 child_proc(void)
 {
@@ -725,15 +846,18 @@ child_proc(void)
     return;
 
   for (;;) {
-    if (term.paste_buffer)
-      term_send_paste();
-
     struct timeval timeout = {0, 100000}, *timeout_p = 0;
-    fd_set fds;
+    fd_set fds, wfds;
     FD_ZERO(&fds);
+    FD_ZERO(&wfds);
     FD_SET(win_fd, &fds);
-    if (pty_fd >= 0)
+    if (pty_fd >= 0) {
       FD_SET(pty_fd, &fds);
+      // send queued input and pending paste contents 
+      // as the pty can take them
+      if (outq.len || term.paste_buffer)
+        FD_SET(pty_fd, &wfds);
+    }
 #ifndef patch_319
     else
 #endif
@@ -807,7 +931,14 @@ child_proc(void)
       exit_mintty();
 #endif
 
-    if (select(win_fd + 1, &fds, 0, 0, timeout_p) > 0) {
+    if (select(win_fd + 1, &fds, &wfds, 0, timeout_p) > 0) {
+      if (pty_fd >= 0 && FD_ISSET(pty_fd, &wfds)) {
+        if (outq.len)
+          outq_flush();
+        // convert more of a paste only once the previous chunk is gone
+        if (!outq.len && term.paste_buffer)
+          term_send_paste();
+      }
       if (pty_fd >= 0 && FD_ISSET(pty_fd, &fds)) {
         // Pty devices on old Cygwin versions (pre 1005) deliver only 4 bytes
         // at a time, and newer ones or MSYS2 deliver up to 256 at a time.
@@ -899,6 +1030,7 @@ child_proc(void)
         }
         else {
           pty_fd = -1;
+          outq_clear();
           term_hide_cursor();
         }
       }
@@ -1092,12 +1224,17 @@ grandchild_process_list(void)
 void
 child_write(const char *buf, uint len)
 {
-  if (pty_fd >= 0) {
-#ifdef debug_pty
-    int n =
-#endif
-    write(pty_fd, buf, len);
-    trace_line("cwrt", n, buf, len);
+  if (pty_fd >= 0 && len) {
+    if (!outq.len) {
+      int n = pty_write(buf, len);
+      if (n < 0)
+        return;
+      buf += n;
+      len -= n;
+    }
+    // keep what the pty did not take (or would overtake queued input)
+    if (len)
+      outq_append(buf, len);
   }
 }
 
@@ -1136,13 +1273,8 @@ child_printf(const char *fmt, ...)
     char *s;
     int len = vasprintf(&s, fmt, va);
     va_end(va);
-    if (len >= 0) {
-#ifdef debug_pty
-      int n =
-#endif
-      write(pty_fd, s, len);
-      trace_line("tprt", n, s, len);
-    }
+    if (len >= 0)
+      child_write(s, len);
     free(s);
   }
 }
@@ -13,6 +13,7 @@ extern bool logging;
 extern void child_proc(void);
 extern void child_kill(bool point_blank);
 extern void child_write(const char *, uint len);
+extern uint child_queued(uint * peak);
 extern void child_break(void);
 extern void child_intr(void);
 extern void child_printf(const char * fmt, ...) __attribute__((format(printf, 1, 2)));
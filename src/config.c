@@ -178,12 +178,14 @@ const config default_cfg = {
   .scrollbar = 1,
   .scrollback_lines = 10000,
   .max_scrollback_lines = 250000,
+  .max_scrollback_kb = 0,
   .scroll_mod = MDK_SHIFT,
   .border_style = BORDER_NORMAL,
   .pgupdn_scroll = false,
   .lang = W(""),
   .search_bar = W(""),
   .search_context = 0,
+  .search_index = false,
   // Terminal
   .term = "xterm",
   .answerback = W(""),
@@ -521,6 +523,7 @@ options[] = {
   {"RewrapOnResize", OPT_BOOL, offcfg(rewrap_on_resize)},
   {"ScrollbackLines", OPT_INT, offcfg(scrollback_lines)},
   {"MaxScrollbackLines", OPT_INT, offcfg(max_scrollback_lines)},
+  {"MaxScrollbackKB", OPT_INT, offcfg(max_scrollback_kb)},
   {"Scrollbar", OPT_SCROLLBAR, offcfg(scrollbar)},
   {"ScrollMod", OPT_MOD, offcfg(scroll_mod)},
   {"BorderStyle", OPT_BORDER, offcfg(border_style)},
@@ -528,6 +531,7 @@ options[] = {
   {"Language", OPT_WSTRING, offcfg(lang)},
   {"SearchBar", OPT_WSTRING, offcfg(search_bar)},
   {"SearchContext", OPT_INT, offcfg(search_context)},
+  {"SearchIndex", OPT_BOOL, offcfg(search_index)},
 
   // Terminal
   {"Term", OPT_STRING, offcfg(term)},
@@ -1859,6 +1863,7 @@ fix_config(void)
 
   // Limit size of scrollback buffer.
   cfg.scrollback_lines = min(cfg.scrollback_lines, cfg.max_scrollback_lines);
+  cfg.max_scrollback_kb = max(0, cfg.max_scrollback_kb);
 }
 
 static void
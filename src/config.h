@@ -165,6 +165,7 @@ typedef struct {
   char rewrap_on_resize;
   int scrollback_lines;
   int max_scrollback_lines;
+  int max_scrollback_kb;
   char scrollbar;
   char scroll_mod;
   char border_style;
@@ -172,6 +173,7 @@ typedef struct {
   wstring lang;
   wstring search_bar;
   int search_context;
+  bool search_index;
   // Terminal
   string term;
   wstring answerback;
@@ -246,6 +246,23 @@ is_rtl_class(uchar bc)
   return mask & (1 << (bc));
 }
 
+/*
+ * Character classes that make do_bidi apply the full algorithm
+ * (rather than leaving a left-to-right paragraph unchanged),
+ * including all characters subject to Arabic shaping (AL).
+ */
+bool
+is_bidi_class(uchar bc)
+{
+  const int mask = (1 << R) | (1 << AL) | (1 << AN)
+                 | (1 << LRE) | (1 << LRO) | (1 << RLE) | (1 << RLO)
+                 | (1 << PDF)
+                 | (1 << LRI) | (1 << RLI) | (1 << FSI) | (1 << PDI)
+                 ;
+
+  return mask & (1 << (bc));
+}
+
 bool
 is_sep_class(uchar bc)
 {
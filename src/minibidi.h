@@ -27,5 +27,6 @@ uchar bidi_class(ucschar ch);
 bool is_sep_class(uchar bc);
 bool is_punct_class(uchar bc);
 bool is_rtl_class(uchar bc);
+bool is_bidi_class(uchar bc);
 
 #endif
@@ -0,0 +1,627 @@
+// raster.c (part of mintty)
+// Licensed under the terms of the GNU General Public License v3 or later.
+
+#include "raster.h"
+#include "config.h"
+
+#include <math.h>
+#include <time.h>
+
+#ifdef FREETYPE
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#endif
+
+
+// UTF-16 surrogates; not from charset.h, so this also builds 
+// with other C libraries for testraster
+#define is_high_surrogate(wc) (((wc) & 0xFC00) == 0xD800)
+#define is_low_surrogate(wc) (((wc) & 0xFC00) == 0xDC00)
+#define combine_surrogates(hwc, lwc) \
+  (((xchar)((hwc) - 0xD7C0) << 10) | ((lwc) & 0x03FF))
+
+
+/*
+ * Pixel output, clipped to the current clip rectangle
+ */
+static rasterbuf * rb;
+static int clip_left, clip_top, clip_right, clip_bottom;  // right/bottom excl.
+
+static void
+setclip(int left, int top, int right, int bottom)
+{
+  clip_left = max(left, 0);
+  clip_top = max(top, 0);
+  clip_right = min(right, rb->width);
+  clip_bottom = min(bottom, rb->height);
+}
+
+static inline uint
+pixel(colour c)
+{
+  // colour is 0x00BBGGRR; pixel bytes are R, G, B, A
+  return (c & 0xFFFFFF) | 0xFF000000;
+}
+
+static void
+fillrect(int left, int top, int right, int bottom, colour c)
+{
+  left = max(left, clip_left);
+  top = max(top, clip_top);
+  right = min(right, clip_right);
+  bottom = min(bottom, clip_bottom);
+  uint p = pixel(c);
+  for (int y = top; y < bottom; y++) {
+    uint * row = rb->pixels + y * rb->width;
+    for (int x = left; x < right; x++)
+      row[x] = p;
+  }
+}
+
+#ifdef FREETYPE
+static void
+blendpixel(int x, int y, colour c, uint alpha)
+{
+  if (x < clip_left || x >= clip_right || y < clip_top || y >= clip_bottom)
+    return;
+  uint * p = rb->pixels + y * rb->width + x;
+  if (alpha >= 255) {
+    *p = pixel(c);
+    return;
+  }
+  uint d = *p;
+  uint r = red(d) + ((int)red(c) - (int)red(d)) * (int)alpha / 255;
+  uint g = green(d) + ((int)green(c) - (int)green(d)) * (int)alpha / 255;
+  uint b = blue(d) + ((int)blue(c) - (int)blue(d)) * (int)alpha / 255;
+  *p = pixel(make_colour(r, g, b));
+}
+#endif
+
+/*
+ * Line with given width; square pen like the GDI pen used for box drawing
+ */
+static void
+thickline(int x1, int y1, int x2, int y2, int w, bool endcaps, colour c)
+{
+  int w1 = w / 2, w2 = w - w / 2;
+  if (x1 == x2 || y1 == y2) {
+    if (x1 > x2) {
+      int t = x1; x1 = x2; x2 = t;
+    }
+    if (y1 > y2) {
+      int t = y1; y1 = y2; y2 = t;
+    }
+    int ext = endcaps ? w1 : 0;
+    if (y1 == y2)
+      fillrect(x1 - ext, y1 - w1, x2 + w2 - w1 + ext, y1 + w2, c);
+    else
+      fillrect(x1 - w1, y1 - ext, x1 + w2, y2 + w2 - w1 + ext, c);
+    return;
+  }
+
+  // Bresenham, stamping the pen at each point
+  int dx = abs(x2 - x1), sx = x1 < x2 ? 1 : -1;
+  int dy = -abs(y2 - y1), sy = y1 < y2 ? 1 : -1;
+  int err = dx + dy;
+  while (true) {
+    fillrect(x1 - w1, y1 - w1, x1 + w2, y1 + w2, c);
+    if (x1 == x2 && y1 == y2)
+      break;
+    int e2 = 2 * err;
+    if (e2 >= dy) {
+      err += dy;
+      x1 += sx;
+    }
+    if (e2 <= dx) {
+      err += dx;
+      y1 += sy;
+    }
+  }
+}
+
+
+/*
+ * Self-drawn Box Drawing characters (U+2500-U+257F),
+ * using the same geometry as wintext.c (boxdrawing.t)
+ */
+static int box_x, box_y, box_width, box_height, line_width;
+static colour box_fg;
+
+static int
+boxscale(int ref, char val, char y3)
+{
+#define dl 0x50
+#define dh 0x51
+  if (val >= dl) {
+    if (val > dl)
+      return ref / 2 + line_width;
+    else
+      return ref / 2 - line_width;
+  }
+  else if (y3 < -3) {
+    // finer-tuned values for dashed lines
+    return ref * val / 72;
+  }
+  else {
+    return ref * val / 24;
+  }
+}
+
+static void
+boxlines(bool heavy, char x1, char y1, char x2, char y2, char x3, char y3)
+{
+  int w = heavy ? line_width + 2 : line_width;
+  int _x1 = box_x + boxscale(box_width, x1, y3);
+  int _y1 = box_y + boxscale(box_height, y1, y3);
+  int _x2 = box_x + boxscale(box_width, x2, y3);
+  int _y2 = box_y + boxscale(box_height, y2, y3);
+  // dashed line segments are drawn without end caps
+  thickline(_x1, _y1, _x2, _y2, w, y3 > -3, box_fg);
+  if (y3 >= 0) {
+    int _x3 = box_x + boxscale(box_width, x3, y3);
+    int _y3 = box_y + boxscale(box_height, y3, y3);
+    thickline(_x2, _y2, _x3, _y3, w, true, box_fg);
+  }
+}
+
+static void
+boxcurve(char q)
+{
+  // quarter arcs ╰ ╭ ╮ ╯, centered outside the cell centre like wintext.c
+  int r = box_width / 2 + 1;
+  int cx = box_x + box_width / 2, cy = box_y + box_height / 2;
+  int xc = 0, yc = 0, a = 0, x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+  switch (q) {
+    when 1:  // ╰
+      xc = cx + r; yc = cy - r; a = 180;
+      x1 = cx; y1 = box_y; x2 = box_x + box_width + 1; y2 = cy;
+    when 2:  // ╭
+      xc = cx + r; yc = cy + r; a = 90;
+      x1 = box_x + box_width; y1 = cy; x2 = cx; y2 = box_y + box_height + 1;
+    when 3:  // ╮
+      xc = cx - r; yc = cy + r; a = 0;
+      x1 = cx; y1 = box_y + box_height; x2 = box_x - 1; y2 = cy;
+    when 4:  // ╯
+      xc = cx - r; yc = cy - r; a = 270;
+      x1 = box_x; y1 = cy; x2 = cx; y2 = box_y - 1;
+  }
+  // line from the start point to the arc, the arc, and on to the end point
+  int px = xc + (int)lround(r * cos(a * M_PI / 180));
+  int py = yc - (int)lround(r * sin(a * M_PI / 180));
+  thickline(x1, y1, px, py, line_width, false, box_fg);
+  for (int i = 1; i <= 90; i++) {
+    int nx = xc + (int)lround(r * cos((a + i) * M_PI / 180));
+    int ny = yc - (int)lround(r * sin((a + i) * M_PI / 180));
+    thickline(px, py, nx, ny, line_width, false, box_fg);
+    px = nx;
+    py = ny;
+  }
+  thickline(px, py, x2, y2, line_width, false, box_fg);
+}
+
+static bool
+boxdraw(wchar c, int x, int y, int width, int height, colour fg)
+{
+  if (c < 0x2500 || c > 0x257F)
+    return false;
+
+  box_x = x;
+  box_y = y;
+  box_width = width;
+  box_height = height;
+  box_fg = fg;
+  int heavydelta = min(line_width, 2);
+  setclip(x, y, x + width, y + height);
+
+  switch (c) {
+// tune position and length of double/triple dash segments
+#define sub2 line_width
+#define add2 2 * line_width
+#define sub3 line_width
+#define add3 line_width
+#include "boxdrawing.t"
+  }
+  return true;
+}
+
+
+/*
+ * Glyphs
+ */
+#ifdef FREETYPE
+static FT_Library ftlib;
+#endif
+
+bool
+raster_load_font(rasterbuf * buf, char * filename)
+{
+#ifdef FREETYPE
+  if (!ftlib && FT_Init_FreeType(&ftlib))
+    return false;
+  FT_Face face;
+  if (FT_New_Face(ftlib, filename, 0, &face))
+    return false;
+  if (buf->face)
+    FT_Done_Face(buf->face);
+  buf->face = face;
+  return true;
+#else
+  (void)buf; (void)filename;
+  return false;
+#endif
+}
+
+/*
+ * Draw a character into the glyph box (gx, gy, gw, gh);
+ * the box may extend beyond the clip rectangle (double-height lines).
+ */
+static void
+drawglyph(xchar c, int gx, int gy, int gw, int gh, bool wide, bool bold, colour fg)
+{
+  if (c == ' ' || c == 0xA0 || c == 0x3000)
+    return;
+
+#ifdef FREETYPE
+  FT_Face face = rb->face;
+  if (face) {
+    static FT_Face size_face;
+    static int size_w, size_h;
+    if (face != size_face || gw != size_w || gh != size_h) {
+      // scale so that ascender and descender fill the glyph box
+      FT_Size_RequestRec req = {
+        .type = FT_SIZE_REQUEST_TYPE_REAL_DIM,
+        .width = 0, .height = gh << 6,
+      };
+      FT_Request_Size(face, &req);
+      size_face = face;
+      size_w = gw;
+      size_h = gh;
+    }
+    FT_Matrix m = {wide ? 0x20000 : 0x10000, 0, 0, 0x10000};
+    FT_Set_Transform(face, &m, 0);
+    if (FT_Load_Char(face, c, FT_LOAD_RENDER))
+      return;
+
+    FT_GlyphSlot g = face->glyph;
+    int asc = face->size->metrics.ascender >> 6;
+    int adv = g->advance.x >> 6;
+    int bx = gx + g->bitmap_left + max(0, (gw - adv) / 2);
+    int by = gy + asc - g->bitmap_top;
+    for (int r = 0; r < (int)g->bitmap.rows; r++) {
+      uchar * src = g->bitmap.buffer + r * g->bitmap.pitch;
+      for (int k = 0; k < (int)g->bitmap.width; k++)
+        if (src[k]) {
+          blendpixel(bx + k, by + r, fg, src[k]);
+          if (bold)
+            blendpixel(bx + k + 1, by + r, fg, src[k]);
+        }
+    }
+    return;
+  }
+#else
+  (void)wide;
+#endif
+
+  // no font: indicate the glyph by a box
+  int inset = max(1, gw / 6);
+  int lw = bold ? line_width + 1 : line_width;
+  int l = gx + inset, t = gy + gh / 5, r = gx + gw - inset, b = gy + gh - gh / 5;
+  fillrect(l, t, r, t + lw, fg);
+  fillrect(l, b - lw, r, b, fg);
+  fillrect(l, t, l + lw, b, fg);
+  fillrect(r - lw, t, r, b, fg);
+}
+
+
+/*
+ * Text runs, like win_text
+ */
+static void
+textcolours(cattr a, colour * pfg, colour * pbg)
+{
+  colour_i fgi = (a.attr & ATTR_FGMASK) >> ATTR_FGSHIFT;
+  colour_i bgi = (a.attr & ATTR_BGMASK) >> ATTR_BGSHIFT;
+  if ((a.attr & ATTR_BOLD) && cfg.bold_as_colour && CCL_ANSI8(fgi))
+    fgi |= 8;
+
+  colour fg = fgi >= TRUE_COLOUR ? a.truefg : rb->palette[fgi];
+  colour bg = bgi >= TRUE_COLOUR ? a.truebg : rb->palette[bgi];
+  if (a.attr & ATTR_DIM)
+    fg = ((fg & 0xFEFEFEFE) >> 1) + ((rb->palette[BG_COLOUR_I] & 0xFEFEFEFE) >> 1);
+  if (a.attr & ATTR_REVERSE) {
+    colour t = fg; fg = bg; bg = t;
+  }
+  if (a.attr & ATTR_INVISIBLE)
+    fg = bg;
+
+  if (a.attr & TATTR_CURRESULT) {
+    bg = cfg.search_current_colour;
+    fg = cfg.search_fg_colour;
+  }
+  else if (a.attr & (TATTR_RESULT | TATTR_CURMARKED)) {
+    bg = cfg.search_bg_colour;
+    fg = cfg.search_fg_colour;
+  }
+
+  if ((a.attr & TATTR_ACTCURS) && term_cursor_type() == CUR_BLOCK) {
+    fg = rb->palette[CURSOR_TEXT_COLOUR_I];
+    bg = rb->palette[CURSOR_COLOUR_I];
+  }
+  *pfg = fg;
+  *pbg = bg;
+}
+
+static void
+rastertext(paint_cmd * pc, wchar * text)
+{
+  cattr attr = pc->attr;
+  ushort lattr = pc->lattr & LATTR_MODE;
+  int cw = rb->cell_width * (lattr == LATTR_NORM ? 1 : 2);
+  int ch = rb->cell_height;
+
+  // only the left half of double-width lines is shown
+  if (lattr != LATTR_NORM && pc->x * 2 >= rb->cols)
+    return;
+  // padding is not part of the framebuffer
+  if (pc->x < 0 || pc->x >= rb->cols)
+    return;
+
+  int charw = attr.attr & TATTR_WIDE ? cw * 2 : cw;
+  int x = pc->x * cw;
+  int y = pc->y * ch;
+  // runs with combining characters or non-BMP characters are single cells
+  bool single = (attr.attr & TATTR_COMBINING)
+                || (pc->len > 1 && is_high_surrogate(text[0]));
+  int ncells = single ? 1 : pc->len;
+
+  colour fg, bg;
+  textcolours(attr, &fg, &bg);
+
+  setclip(x, y, x + ncells * charw, y + ch);
+  if (pc->phase != 2)
+    fillrect(x, y, x + ncells * charw, y + ch, bg);
+  if (pc->phase == 1)
+    return;
+
+  // glyph box; double-height lines show the top or bottom half
+  int gy = y, gh = ch;
+  if (lattr == LATTR_TOP || lattr == LATTR_BOT) {
+    gh = 2 * ch;
+    if (lattr == LATTR_BOT)
+      gy -= ch;
+  }
+  bool bold = attr.attr & ATTR_BOLD;
+  int findex = (attr.attr & FONTFAM_MASK) >> ATTR_FONTFAM_SHIFT;
+  for (int i = 0; i < pc->len; i++) {
+    xchar c = text[i];
+    if (is_high_surrogate(c) && i + 1 < pc->len && is_low_surrogate(text[i + 1])) {
+      c = combine_surrogates(c, text[i + 1]);
+      i++;
+    }
+    int gx = single ? x : x + i * charw;
+    if (findex == 11 && boxdraw(c, gx, y, charw, ch, fg)) {
+      setclip(x, y, x + ncells * charw, y + ch);
+      continue;
+    }
+    drawglyph(c, gx, gy, charw, gh, lattr != LATTR_NORM, bold, fg);
+  }
+
+  // decorations
+  int right = x + ncells * charw;
+  colour ul = (attr.attr & ATTR_ULCOLOUR) ? attr.ulcolr : fg;
+  if (attr.attr & UNDER_MASK) {
+    int uy = y + ch - 2 * line_width;
+    fillrect(x, uy, right, uy + line_width, ul);
+    if ((attr.attr & UNDER_MASK) == ATTR_DOUBLYUND)
+      fillrect(x, uy - 2 * line_width, right, uy - line_width, ul);
+  }
+  if (attr.attr & ATTR_STRIKEOUT)
+    fillrect(x, y + ch / 2, right, y + ch / 2 + line_width, fg);
+  if (attr.attr & ATTR_OVERL)
+    fillrect(x, y, right, y + line_width, fg);
+
+  // cursor other than block
+  if (attr.attr & (TATTR_ACTCURS | TATTR_PASCURS)) {
+    colour cc = rb->palette[CURSOR_COLOUR_I];
+    int cx = x + (attr.attr & TATTR_RIGHTCURS ? charw / 2 : 0);
+    int cr = cx + charw;
+    int type = term_cursor_type();
+    if ((attr.attr & TATTR_PASCURS) || type == CUR_BOX) {
+      fillrect(cx, y, cr, y + 1, cc);
+      fillrect(cx, y + ch - 1, cr, y + ch, cc);
+      fillrect(cx, y, cx + 1, y + ch, cc);
+      fillrect(cr - 1, y, cr, y + ch, cc);
+    }
+    else if (type == CUR_UNDERSCORE)
+      fillrect(cx, y + ch - 2 * line_width, cr, y + ch, cc);
+    else if (type == CUR_LINE)
+      fillrect(cx, y, cx + 2 * line_width, y + ch, cc);
+  }
+}
+
+/*
+ * Sixel graphics; other images are not decoded here
+ */
+static void
+rasterimages(void)
+{
+  for (imglist * img = term.imgs.first; img; img = img->next) {
+    if (img->len || !img->pixels || !img->pixelwidth || !img->pixelheight)
+      continue;
+    int top = img->top - term.virtuallines - term.disptop;
+    if (top + img->height <= 0 || top >= term.rows)
+      continue;
+
+    int iw = img->width * rb->cell_width, ih = img->height * rb->cell_height;
+    for (int y = max(0, top); y < min(top + img->height, term.rows); y++)
+      for (int x = img->left; x < min(img->left + img->width, rb->cols); x++) {
+        // cells overwritten by text are excluded
+        if (term.displines[y]->chars[x].chr != SIXELCH)
+          continue;
+        setclip(x * rb->cell_width, y * rb->cell_height,
+                (x + 1) * rb->cell_width, (y + 1) * rb->cell_height);
+        for (int py = clip_top; py < clip_bottom; py++) {
+          int sy = (py - top * rb->cell_height) * img->pixelheight / ih;
+          uchar * src = img->pixels + sy * img->pixelwidth * 4;
+          for (int px = clip_left; px < clip_right; px++) {
+            int sx = (px - img->left * rb->cell_width) * img->pixelwidth / iw;
+            // sixel pixels are stored as B, G, R, x
+            uchar * s = src + sx * 4;
+            rb->pixels[py * rb->width + px] = pixel(make_colour(s[2], s[1], s[0]));
+          }
+        }
+      }
+  }
+}
+
+
+void
+raster_init(rasterbuf * buf, int rows, int cols, int cell_width, int cell_height)
+{
+  void * face = buf->face;
+  memset(buf, 0, sizeof(rasterbuf));
+  buf->face = face;
+  buf->rows = rows;
+  buf->cols = cols;
+  buf->cell_width = cell_width;
+  buf->cell_height = cell_height;
+  buf->width = cols * cell_width;
+  buf->height = rows * cell_height;
+  buf->pixels = newn(uint, buf->width * buf->height);
+  for (int i = 0; i < buf->width * buf->height; i++)
+    buf->pixels[i] = 0xFF000000;
+}
+
+void
+raster_free(rasterbuf * buf)
+{
+  free(buf->pixels);
+  buf->pixels = 0;
+#ifdef FREETYPE
+  if (buf->face)
+    FT_Done_Face(buf->face);
+#endif
+  buf->face = 0;
+}
+
+/*
+ * Execute the render commands of the current frame, then draw images.
+ */
+void
+raster_paint(rasterbuf * buf)
+{
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  rb = buf;
+  line_width = max(1, (buf->cell_height + 8) / 16);
+  termpaint * tp = &term.paint;
+  for (int k = 0; k < tp->len; k++) {
+    paint_cmd * pc = &tp->cmds[k];
+    // emoji graphics are not rendered; their background is a text command
+    if (pc->type == PAINT_TEXT)
+      rastertext(pc, tp->text + pc->text);
+  }
+  rasterimages();
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  uint usec = (t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_nsec - t0.tv_nsec) / 1000;
+  buf->frames++;
+  buf->last_time = usec;
+  buf->max_time = max(buf->max_time, usec);
+  buf->total_time += usec;
+}
+
+
+/*
+ * PNG output, with uncompressed (stored) deflate blocks
+ */
+static uint crc_table[256];
+
+static uint
+crc(uint c, uchar * data, uint len)
+{
+  if (!crc_table[1])
+    for (uint n = 0; n < 256; n++) {
+      uint v = n;
+      for (int k = 0; k < 8; k++)
+        v = v & 1 ? 0xEDB88320 ^ (v >> 1) : v >> 1;
+      crc_table[n] = v;
+    }
+  c = ~c;
+  for (uint i = 0; i < len; i++)
+    c = crc_table[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+  return ~c;
+}
+
+static void
+put32(uchar * p, uint v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static bool
+png_chunk(FILE * f, char * type, uchar * data, uint len)
+{
+  uchar head[8], tail[4];
+  put32(head, len);
+  memcpy(head + 4, type, 4);
+  put32(tail, crc(crc(0, head + 4, 4), data, len));
+  return fwrite(head, 8, 1, f) == 1
+      && (!len || fwrite(data, len, 1, f) == 1)
+      && fwrite(tail, 4, 1, f) == 1;
+}
+
+bool
+raster_write_png(rasterbuf * buf, char * filename)
+{
+  FILE * f = fopen(filename, "wb");
+  if (!f)
+    return false;
+
+  uint rowlen = buf->width * 4 + 1;  // with filter type byte
+  uint rawlen = rowlen * buf->height;
+  uint nblocks = rawlen / 0xFFFF + 1;
+  uint zlen = 2 + rawlen + 5 * nblocks + 4;
+  uchar * z = newn(uchar, zlen);
+  uchar * p = z;
+  *p++ = 0x78;  // zlib header: deflate, 32K window
+  *p++ = 0x01;
+  uint a = 1, b = 0;  // Adler-32
+  uint pos = 0;  // position in raw data
+  for (uint n = 0; n < nblocks; n++) {
+    uint blen = min(rawlen - pos, 0xFFFFu);
+    *p++ = n == nblocks - 1;  // BFINAL, stored block
+    *p++ = blen;
+    *p++ = blen >> 8;
+    *p++ = ~blen;
+    *p++ = ~blen >> 8;
+    for (uint i = 0; i < blen; i++, pos++) {
+      uint y = pos / rowlen, x = pos % rowlen;
+      uchar c = x ? ((uchar *)(buf->pixels + y * buf->width))[x - 1] : 0;
+      *p++ = c;
+      a = (a + c) % 65521;
+      b = (b + a) % 65521;
+    }
+  }
+  put32(p, b << 16 | a);
+
+  uchar ihdr[13];
+  put32(ihdr, buf->width);
+  put32(ihdr + 4, buf->height);
+  ihdr[8] = 8;   // bit depth
+  ihdr[9] = 6;   // RGBA
+  ihdr[10] = 0;  // deflate
+  ihdr[11] = 0;  // adaptive filtering
+  ihdr[12] = 0;  // no interlace
+
+  bool ok = fwrite("\x89PNG\r\n\x1a\n", 8, 1, f) == 1
+         && png_chunk(f, "IHDR", ihdr, sizeof ihdr)
+         && png_chunk(f, "IDAT", z, zlen)
+         && png_chunk(f, "IEND", 0, 0);
+  free(z);
+  return !fclose(f) && ok;
+}
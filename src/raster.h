@@ -0,0 +1,33 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include "term.h"
+
+/*
+ * Software rendering of the terminal display into an in-memory
+ * framebuffer, executing the render commands of term_paint (term.paint)
+ * without the Windows GDI, for example to compare rendering results
+ * pixel by pixel or to measure paint performance.
+ * Like the window, the framebuffer keeps its contents between frames
+ * and is only updated as described by the commands.
+ */
+typedef struct {
+  int rows, cols;
+  int cell_width, cell_height;
+  int width, height;            // pixels
+  uint * pixels;                // bytes R, G, B, A
+  colour palette[COLOUR_NUM];   // indexed colours, as from win_get_colour
+  void * face;                  // font (FreeType), or null for box glyphs
+  // frame statistics, in microseconds
+  uint frames;
+  uint last_time, max_time;
+  unsigned long long total_time;
+} rasterbuf;
+
+extern void raster_init(rasterbuf *, int rows, int cols, int cell_width, int cell_height);
+extern void raster_free(rasterbuf *);
+extern bool raster_load_font(rasterbuf *, char * filename);
+extern void raster_paint(rasterbuf *);
+extern bool raster_write_png(rasterbuf *, char * filename);
+
+#endif
@@ -83,7 +83,14 @@ extern char *asform(const char *fmt, ...);
 #endif
 #define _WIN32_WINNT WINVER
 
+#if defined(__CYGWIN__) || defined(_WIN32)
 #include <windef.h>
+#else
+// standalone test programs on other platforms (testraster)
+typedef unsigned short WCHAR;
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
 
 #ifdef DMALLOC
 #include <dmalloc.h>
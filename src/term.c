@@ -509,15 +509,32 @@ term_reconfig(void)
     toggle_status_line();
 }
 
+/*
+   Search positions are absolute (see result.idx in term.h);
+   these are the bounds of what scrollback + screen currently hold.
+ */
+static long long int
+search_begin(void)
+{
+  return (term.sbseq - term.sblines) * term.cols;
+}
+
+static long long int
+search_end(void)
+{
+  return (term.sbseq + term.rows) * term.cols;
+}
+
 static int
 in_results(pos scrpos)
 {
   if (term.results.xquery_length == 0) {
     return 0;
   }
-  int idx = scrpos.x + (scrpos.y + term.sblines) * term.cols;
+  // not searched yet (see search_expand_display)
+  long long int idx = scrpos.x + (scrpos.y + term.sbseq) * term.cols;
   if (!(term.results.range_begin <= idx && idx < term.results.range_end)) {
-    term_search_expand(idx);
+    return 0;
   }
 
   int b = 0;
@@ -642,6 +659,544 @@ case_fold(uint ch)
   return ch;
 }
 
+/*
+   Convert cells [x0, x1) of a line into the character stream searched:
+   case-folded, with surrogate pairs combined and the second cells of 
+   wide characters dropped. Optionally note the cell position of each 
+   character, for absolute line number y.
+ */
+static int
+search_fold_line(termline * line, long long int y, int x0, int x1, xchar * text, long long int * cell)
+{
+  int len = 0;
+  for (int x = x0; x < x1; x++) {
+    termchar * chr = line->chars + x;
+    xchar ch = chr->chr;
+    // Skip the second cell of any wide characters
+    if (ch == UCSWIDE)
+      continue;
+    if (is_high_surrogate(chr->chr) && chr->cc_next) {
+      termchar * cc = chr + chr->cc_next;
+      if (is_low_surrogate(cc->chr)) {
+        ch = combine_surrogates(chr->chr, cc->chr);
+      }
+    }
+    text[len] = case_fold(ch);
+    if (cell)
+      cell[len] = y * term.cols + x;
+    len++;
+  }
+  return len;
+}
+
+/*
+   Optional scrollback index (SearchIndex=yes): for each scrollback line, 
+   a 256-bit signature of the hashed trigrams of searched text that end 
+   in the line, including those spanning from the previous line.
+   Signatures are kept in chunks parallel to term.scrollback; the index 
+   is built on the first search and then maintained by scrollback_push, 
+   scrollback_pop and scrollback_drop_oldest, and dropped when lines are 
+   rewrapped or the width changes.
+ */
+typedef struct {
+  unsigned long long bits[4];
+} sbsig;
+
+static struct {
+  bool valid;
+  sbsig ** chunks;
+  int nchunks;
+  // trailing characters of the last line, to be joined with the next one;
+  // ntail < 0 if unknown
+  xchar tail[2];
+  int ntail;
+} sbindex;
+
+static inline void
+sbsig_add(sbsig * sig, xchar a, xchar b, xchar c)
+{
+  uint bit = ((a * 31 + b) * 31 + c) * 0x9E3779B1u >> 24;
+  sig->bits[bit >> 6] |= 1ULL << (bit & 63);
+}
+
+static void
+sbindex_sig(sbsig * sig, termline * line)
+{
+  if (!line || line->cols != term.cols) {
+    // Cannot tell what this line looks like when searched;
+    // let it match anything
+    memset(sig, 0xFF, sizeof(sbsig));
+    sbindex.ntail = -1;
+    return;
+  }
+
+  xchar text[2 + line->cols];
+  int n = 0;
+  if (sbindex.ntail > 0) {
+    memcpy(text, sbindex.tail, sbindex.ntail * sizeof(xchar));
+    n = sbindex.ntail;
+  }
+  n += search_fold_line(line, 0, 0, line->cols, text + n, null);
+
+  if (sbindex.ntail < 0)
+    memset(sig, 0xFF, sizeof(sbsig));
+  else {
+    *sig = (sbsig){{0}};
+    for (int i = 2; i < n; i++)
+      sbsig_add(sig, text[i - 2], text[i - 1], text[i]);
+  }
+
+  sbindex.ntail = min(n, 2);
+  memcpy(sbindex.tail, text + n - sbindex.ntail, sbindex.ntail * sizeof(xchar));
+}
+
+static void
+sbindex_clear(void)
+{
+  while (sbindex.nchunks)
+    free(sbindex.chunks[--sbindex.nchunks]);
+  free(sbindex.chunks);
+  sbindex.chunks = 0;
+  sbindex.valid = false;
+}
+
+static void
+sbindex_build(void)
+{
+  sbindex_clear();
+  sbindex.chunks = newn(sbsig *, term.sbchunks);
+  if (!sbindex.chunks)
+    return;
+  while (sbindex.nchunks < term.sbchunks) {
+    sbsig * chunk = newn(sbsig, SBCHUNK);
+    if (!chunk) {
+      sbindex_clear();
+      return;
+    }
+    sbindex.chunks[sbindex.nchunks++] = chunk;
+  }
+
+  init_case_folding();
+  sbindex.ntail = 0;
+  for (int i = 0; i < term.sblines; i++) {
+    termline * line = decompressline(*scrollback_line(i), null);
+    resizeline(line, term.cols);  // as fetched
+    sbindex_sig(sbchunkline(sbindex.chunks, term.sbfirst, i), line);
+    freeline(line);
+  }
+  sbindex.valid = true;
+}
+
+// Index a line just appended to the scrollback at position pos
+static void
+sbindex_push(int pos, termline * line)
+{
+  if (!sbindex.valid)
+    return;
+  if (pos / SBCHUNK == sbindex.nchunks) {
+    sbsig * chunk = newn(sbsig, SBCHUNK);
+    sbsig ** chunks = renewn(sbindex.chunks, sbindex.nchunks + 1);
+    if (chunks)
+      sbindex.chunks = chunks;
+    if (!chunk || !chunks) {
+      free(chunk);
+      sbindex_clear();
+      return;
+    }
+    sbindex.chunks[sbindex.nchunks++] = chunk;
+  }
+  sbindex_sig(&sbindex.chunks[pos / SBCHUNK][pos % SBCHUNK], line);
+}
+
+// Follow the scrollback releasing chunks at either end
+static void
+sbindex_release(bool first)
+{
+  if (!sbindex.valid)
+    return;
+  if (first) {
+    free(sbindex.chunks[0]);
+    sbindex.nchunks--;
+    memmove(sbindex.chunks, sbindex.chunks + 1, sbindex.nchunks * sizeof(sbsig *));
+  }
+  else
+    while (sbindex.nchunks > term.sbchunks)
+      free(sbindex.chunks[--sbindex.nchunks]);
+}
+
+/*
+   Whether a match of the query with signature qsig, which may extend 
+   over reach following lines, could start in scrollback line y.
+ */
+static bool
+sbindex_candidate(int y, int reach, sbsig * qsig)
+{
+  if (y + reach >= term.sblines)
+    return true;
+  sbsig sig = *sbchunkline(sbindex.chunks, term.sbfirst, y);
+  for (int j = 1; j <= reach; j++) {
+    sbsig * next = sbchunkline(sbindex.chunks, term.sbfirst, y + j);
+    for (int k = 0; k < 4; k++)
+      sig.bits[k] |= next->bits[k];
+  }
+  for (int k = 0; k < 4; k++)
+    if (qsig->bits[k] & ~sig.bits[k])
+      return false;
+  return true;
+}
+
+/*
+   Logical-line index of the scrollback: the absolute line numbers 
+   (see term.sbseq) of the scrollback lines that begin a logical line, 
+   i.e. that are not continued from a wrapped preceding line, ascending.
+   It is maintained from the compressed line headers by scrollback_push, 
+   scrollback_pop and scrollback_drop_oldest, so the bounds of a wrapped 
+   line can be found by binary search instead of fetching line by line.
+ */
+static struct {
+  bool valid;
+  long long int * starts;
+  int first, len, size;
+  // whether the last scrollback line wraps into the screen
+  bool wrapped;
+} sbparas = {.valid = true};
+
+static void
+sbparas_clear(void)
+{
+  free(sbparas.starts);
+  sbparas.starts = 0;
+  sbparas.first = sbparas.len = sbparas.size = 0;
+  sbparas.wrapped = false;
+  sbparas.valid = true;
+}
+
+// Index a line about to be appended to the scrollback as line y
+static void
+sbparas_push(long long int y, uchar * cline)
+{
+  bool start = !term.sblines || !sbparas.wrapped;
+  int cols, used;
+  sbparas.wrapped = compressedlattr(cline, &cols, &used) & LATTR_WRAPPED;
+  if (!start || !sbparas.valid)
+    return;
+
+  if (sbparas.first + sbparas.len == sbparas.size) {
+    if (sbparas.first && sbparas.first >= sbparas.len) {
+      // at least half of the array is dropped entries; reuse it
+      memmove(sbparas.starts, sbparas.starts + sbparas.first, 
+              sbparas.len * sizeof(long long int));
+      sbparas.first = 0;
+    }
+    else {
+      int size = sbparas.size ? sbparas.size * 2 : 256;
+      long long int * starts = renewn(sbparas.starts, size);
+      if (!starts) {
+        // fall back to checking lines one by one
+        free(sbparas.starts);
+        sbparas.starts = 0;
+        sbparas.first = sbparas.len = sbparas.size = 0;
+        sbparas.valid = false;
+        return;
+      }
+      sbparas.starts = starts;
+      sbparas.size = size;
+    }
+  }
+  sbparas.starts[sbparas.first + sbparas.len++] = y;
+}
+
+// Follow the scrollback dropping lines before line top
+static void
+sbparas_drop(long long int top)
+{
+  while (sbparas.len && sbparas.starts[sbparas.first] < top) {
+    sbparas.first++;
+    sbparas.len--;
+  }
+  if (!sbparas.len)
+    sbparas.first = 0;
+}
+
+// Follow the scrollback popping its last line y
+static void
+sbparas_pop(long long int y)
+{
+  if (sbparas.len && sbparas.starts[sbparas.first + sbparas.len - 1] == y)
+    sbparas.len--;
+  sbparas.wrapped = false;
+  if (term.sblines) {
+    int cols, used;
+    uchar * cline = *scrollback_line(term.sblines - 1);
+    sbparas.wrapped = compressedlattr(cline, &cols, &used) & LATTR_WRAPPED;
+  }
+}
+
+// Number of indexed logical lines that begin at or before line y
+static int
+sbparas_find(long long int y)
+{
+  int lo = 0, hi = sbparas.len;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (sbparas.starts[sbparas.first + mid] <= y)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static bool
+line_wraps(int y)
+{
+  termline * line = fetch_line(y);
+  bool wrapped = line->lattr & LATTR_WRAPPED;
+  release_line(line);
+  return wrapped;
+}
+
+/*
+   First row of the logical line containing row y, 
+   not looking back beyond row top.
+ */
+static int
+para_first(int y, int top)
+{
+  while (y > top) {
+    if (y < 0 && sbparas.valid) {
+      int k = sbparas_find(term.sbseq + y);
+      if (!k)
+        return top;
+      return max(top, (int)(sbparas.starts[sbparas.first + k - 1] - term.sbseq));
+    }
+    if (!line_wraps(y - 1))
+      break;
+    y--;
+  }
+  return y;
+}
+
+/*
+   First and last row of the logical (wrapped) line containing row y.
+ */
+int
+term_para_first(int y)
+{
+  return para_first(y, -sblines());
+}
+
+int
+term_para_last(int y)
+{
+  while (y < term.rows - 1) {
+    if (y < 0 && sbparas.valid) {
+      int k = sbparas_find(term.sbseq + y);
+      if (k < sbparas.len)
+        return sbparas.starts[sbparas.first + k] - 1 - term.sbseq;
+      if (!sbparas.wrapped)
+        return -1;
+      y = 0;
+      continue;
+    }
+    if (!line_wraps(y))
+      break;
+    y++;
+  }
+  return y;
+}
+
+static void do_search(long long int begin, long long int end, void (*found)(result));
+
+/*
+   Count all matches without blocking the window: each timer tick scans 
+   slices of SEARCH_COUNT_LINES lines for at most SEARCH_COUNT_TICKS ms.
+   A slice is scanned a little beyond its end so that a match starting 
+   in it is counted even if it spans into the next slice.
+   The count reached at the end of each slice is kept as a checkpoint, 
+   so that changed lines can be recounted from the checkpoint before them.
+ */
+#define SEARCH_COUNT_LINES 256
+#define SEARCH_COUNT_TICKS 20
+
+static long long int count_limit, count_next;
+
+static void
+count_add(result run)
+{
+  if (run.idx < count_limit) {
+    term.results.count++;
+    count_next = max(count_next, run.idx + run.len);
+  }
+}
+
+static struct countmark {
+  long long int pos;  // matches starting before pos have been counted
+  int count;
+} * count_marks;
+static int count_nmarks, count_capmarks;
+
+static void
+count_mark(void)
+{
+  if (count_nmarks == count_capmarks) {
+    int cap = count_capmarks ? count_capmarks * 2 : 16;
+    struct countmark * marks = renewn(count_marks, cap);
+    if (!marks)
+      return;
+    count_marks = marks;
+    count_capmarks = cap;
+  }
+  count_marks[count_nmarks++] = (struct countmark)
+    {.pos = term.results.count_pos, .count = term.results.count};
+}
+
+// Count the matches starting in [pos, limit)
+static void
+do_search_count(long long int pos, long long int limit)
+{
+  count_limit = limit;
+  count_next = count_limit;
+  // regular expression matches may extend further, within their line
+  int overscan = term.results.regex_mode ? term.cols * 8 : term.results.xquery_length * 2;
+  do_search(pos, min(count_limit + overscan, search_end()), count_add);
+}
+
+/*
+   Matches per line in the oldest scrollback lines, counted in one search 
+   when the first of them is dropped, so that heavy output does not need 
+   a search for each line pushed out of the scrollback.
+   They are valid for lines from count_drops_pos (the oldest line) 
+   and for matches starting before count_drops_limit.
+ */
+static int * count_drops;
+static int count_ndrops, count_dropi;
+static long long int count_drops_pos, count_drops_limit;
+
+static void
+count_drop_add(result run)
+{
+  if (run.idx < count_drops_limit)
+    count_drops[(run.idx - count_drops_pos) / term.cols]++;
+}
+
+// Discount the matches in the oldest scrollback line, before it is dropped
+static void
+count_drop(void)
+{
+  long long int begin = search_begin();
+  long long int end = begin + term.cols;
+  if (!term.results.xquery_length || term.results.count_pos <= begin)
+    return;
+
+  if (count_dropi >= count_ndrops || count_drops_pos != begin
+      || (count_drops_limit < end 
+          && count_drops_limit != term.results.count_pos)
+     ) {
+    // count the matches in a batch of the oldest lines
+    if (!count_drops)
+      count_drops = newn(int, SEARCH_COUNT_LINES);
+    long long int limit = min(begin + SEARCH_COUNT_LINES * term.cols,
+                              term.results.count_pos);
+    count_dropi = 0;
+    count_ndrops = (limit - begin + term.cols - 1) / term.cols;
+    memset(count_drops, 0, count_ndrops * sizeof(int));
+    count_drops_pos = begin;
+    count_drops_limit = limit;
+    int overscan = term.results.regex_mode ? term.cols * 8 : term.results.xquery_length * 2;
+    do_search(begin, min(limit + overscan, search_end()), count_drop_add);
+  }
+  int dropped = count_drops[count_dropi++];
+  count_drops_pos = end;
+  term.results.count -= dropped;
+
+  int n = 0;
+  while (n < count_nmarks && count_marks[n].pos <= end)
+    n++;
+  count_nmarks -= n;
+  memmove(count_marks, count_marks + n, count_nmarks * sizeof(struct countmark));
+  for (int i = 0; i < count_nmarks; i++)
+    count_marks[i].count -= dropped;
+}
+
+static void search_count_cb(void);
+
+/*
+   Stop counting while lines are rewrapped or resized, which voids 
+   search positions until the next full update.
+ */
+static void
+count_void(void)
+{
+  term.results.counting = false;
+  term.results.count_pos = 0;
+  count_nmarks = 0;
+  count_ndrops = 0;
+}
+
+// Recount matches from the last checkpoint not after pos
+static void
+count_rewind(long long int pos)
+{
+  if (term.results.count_pos > pos) {
+    count_ndrops = 0;
+    while (count_nmarks && count_marks[count_nmarks - 1].pos > pos)
+      count_nmarks--;
+    if (count_nmarks) {
+      term.results.count_pos = count_marks[count_nmarks - 1].pos;
+      term.results.count = count_marks[count_nmarks - 1].count;
+    }
+    else {
+      term.results.count_pos = search_begin();
+      term.results.count = 0;
+    }
+  }
+  // also count lines appended since counting was complete
+  if (!term.results.counting && term.results.count_pos < search_end()) {
+    term.results.counting = true;
+    win_set_timer(search_count_cb, 1);
+  }
+}
+
+static void
+search_count_cb(void)
+{
+  if (!term.results.counting)
+    return;
+
+  long long int max_idx = search_end();
+  ulong t0 = mtime();
+  do {
+    // skip lines that have left the scrollback meanwhile
+    long long int pos = max(term.results.count_pos, search_begin());
+    if (pos >= max_idx || !term.results.xquery_length) {
+      term.results.counting = false;
+      break;
+    }
+    long long int limit = min(pos + SEARCH_COUNT_LINES * term.cols, max_idx);
+    // end a slice at the screen, where changes are to be expected
+    long long int screen = term.sbseq * term.cols;
+    if (pos < screen)
+      limit = min(limit, screen);
+    do_search_count(pos, limit);
+    term.results.count_pos = count_next;
+    count_mark();
+  } while (mtime() - t0 < SEARCH_COUNT_TICKS);
+
+  win_update_search_count();
+  if (term.results.counting)
+    win_set_timer(search_count_cb, 1);
+}
+
+/*
+   The displayed lines are searched for highlighting while painting, 
+   but only a slice at a time; the rest is searched by timer ticks 
+   of at most SEARCH_COUNT_TICKS ms, repainting as results are found.
+   A new query cancels a pending expansion.
+ */
+static long long int expand_begin, expand_end;
+static bool expanding;
+
 void
 term_set_search(wchar * needle)
 {
@@ -651,6 +1206,7 @@ term_set_search(wchar * needle)
   // transform UTF-16 to UCS for matching
   int wlen = wcslen(needle);
   xchar * xquery = malloc(sizeof(xchar) * (wlen + 1));
+  xchar * ucs = malloc(sizeof(xchar) * (wlen + 1));
   wchar prev = 0;
   int xlen = -1;
   for (int i = 0; i < wlen; i++) {
@@ -661,21 +1217,40 @@ term_set_search(wchar * needle)
       ++xlen;
       xqueri = needle[i];
     }
+    ucs[xlen] = xqueri;
     xquery[xlen] = case_fold(xqueri);
     prev = needle[i];
   }
   xquery[++xlen] = 0;
 
+  // compile the unfolded query, so escapes like \W keep their case
+  regex_free(term.results.rx);
+  term.results.rx = 0;
+  if (term.results.regex_mode && xlen) {
+    init_case_folding();
+    term.results.rx = regex_compile(ucs, xlen, case_fold);
+  }
+  free(ucs);
+
   free(term.results.xquery);
   term.results.xquery = xquery;
   term.results.xquery_length = xlen;
   term.results.update_type = FULL_UPDATE;
+  // abandon the search of the previous query
+  expanding = false;
 }
 
+static void search_refresh(long long int l0, long long int l1);
+
 void
 term_update_search(void)
 {
-  if (term.results.update_type == NO_UPDATE)
+  // search all lines at the current width
+  if (term.results.xquery_length && term.sbpending)
+    term_rewrap_pending();
+
+  int update_type = term.results.update_type;
+  if (update_type == NO_UPDATE)
     return;
   term.results.update_type = NO_UPDATE;
 
@@ -684,94 +1259,196 @@ term_update_search(void)
     return;
   }
 
+  long long int dirty_begin = term.results.dirty_begin;
+  long long int dirty_end = term.results.dirty_end;
+  term.results.dirty_begin = term.results.dirty_end = 0;
+
+  // Output only changed some lines: keep the results of the others
+  if (update_type == PARTIAL_UPDATE) {
+    if (dirty_begin < dirty_end)
+      search_refresh(dirty_begin, dirty_end);
+    win_update_search_count();
+    return;
+  }
+
   term_clear_results();
-  // The actual search happens inside in_results().
+  // The actual search happens in term_paint(), see search_expand_display().
+
+  if (cfg.search_index && !sbindex.valid)
+    sbindex_build();
+
+  // Restart counting; this also abandons the count of a previous query.
+  term.results.count = 0;
+  term.results.count_pos = search_begin();
+  count_nmarks = 0;
+  count_ndrops = 0;
+  if (!term.results.counting) {
+    term.results.counting = true;
+    win_set_timer(search_count_cb, 1);
+  }
+  win_update_search_count();
 }
 
-// return search results contained by [begin, end)
+// Horspool bad-character shifts, indexed by the low bits of a folded char;
+// characters sharing the same low bits get the smallest of their shifts.
+#define SEARCH_SHIFT_BITS 8
+#define search_shift_index(ch) ((ch) & ((1 << SEARCH_SHIFT_BITS) - 1))
+
+// longest stretch of wrapped lines searched as one for regular expressions
+#define REGEX_MAXTEXT 0x10000
+
+/*
+   Report regular expression matches contained by [begin, end).
+   Matches do not extend beyond a line, but across line wrapping; 
+   ^ and $ anchor them to the beginning and end of such wrapped lines.
+ */
+static void
+do_search_regex(long long int begin, long long int end, void (*found)(result))
+{
+  regex * rx = term.results.rx;
+  int cap = 0;
+  xchar * text = 0;
+  long long int * cell = 0;
+  int len = 0;
+
+  long long int y0 = begin / term.cols;
+  long long int y1 = (end - 1) / term.cols;
+  bool bol = !(begin % term.cols);
+  if (bol && y0 > term.sbseq - term.sblines) {
+    termline * prevline = fetch_line(y0 - 1 - term.sbseq);
+    bol = !(prevline->lattr & LATTR_WRAPPED);
+    release_line(prevline);
+  }
+
+  for (long long int y = y0; y <= y1; y++) {
+    if (len + term.cols > cap) {
+      cap = len + term.cols * 4;
+      text = renewn(text, cap);
+      cell = renewn(cell, cap);
+    }
+
+    termline * line = fetch_line(y - term.sbseq);
+    int x0 = y == y0 ? begin % term.cols : 0;
+    int x1 = y == y1 ? (end - 1) % term.cols + 1 : term.cols;
+    bool eol = x1 == term.cols && !(line->lattr & LATTR_WRAPPED);
+    x1 = min(x1, (int)line->cols);
+    len += search_fold_line(line, y, x0, x1, text + len, cell + len);
+    release_line(line);
+
+    if (eol || y == y1 || len >= REGEX_MAXTEXT) {
+      int from = 0, e;
+      int s;
+      while ((s = regex_search(rx, text, len, from, bol, eol, &e)) >= 0) {
+        result run = {
+          .idx = cell[s],
+          .len = cell[e - 1] + 1 - cell[s]
+        };
+        assert(begin <= run.idx && (run.idx + run.len) <= end);
+        found(run);
+        from = e;
+      }
+      bol = eol;
+      len = 0;
+    }
+  }
+
+  free(text);
+  free(cell);
+}
+
+// report search results contained by [begin, end)
 static void
-do_search(int begin, int end)
+do_search(long long int begin, long long int end, void (*found)(result))
 {
   //printf("do_search %d %d\n", begin, end);
-  if (term.results.xquery_length == 0) {
+  int m = term.results.xquery_length;
+  if (m == 0 || begin >= end) {
+    return;
+  }
+
+  if (term.results.regex_mode) {
+    // nothing to find for an invalid pattern
+    if (term.results.rx)
+      do_search_regex(begin, end, found);
     return;
   }
 
   init_case_folding();
 
-  /* the position of current char */
-  int cpos = begin;
-  /* the number of matched chars in the current run */
-  int npos = 0;
-  /* the number of matched cells in the current run (anpos >= npos) */
-  int anpos = 0;
-
-  // Loop over every character and search for query.
-  termline * line = NULL;
-  int line_y = -1;
-  while (cpos < end) {
-    // Determine the current position.
-    int x = (cpos % term.cols);
-    int y = (cpos / term.cols);
-    if (line_y != y) {
-      // If our current position isn't in the termline, add it in.
-      if (line) {
-        release_line(line);
+  xchar * pat = term.results.xquery;
+  int shift[1 << SEARCH_SHIFT_BITS];
+  for (uint i = 0; i < lengthof(shift); i++)
+    shift[i] = m;
+  for (int i = 0; i < m - 1; i++)
+    shift[search_shift_index(pat[i])] = m - 1 - i;
+
+  // Folded characters of the lines scanned so far, with the index of the 
+  // cell each one starts at; the tail of a line that might still begin 
+  // a match is carried over to the next line.
+  int cap = term.cols + m;
+  xchar * text = newn(xchar, cap);
+  long long int * cell = newn(long long int, cap);
+  int len = 0;
+
+  // With the scrollback index, scan only lines in which a match may start 
+  // and the lines following them that such a match may extend into
+  bool indexed = sbindex.valid && m >= 3;
+  sbsig qsig = {{0}};
+  int reach = (2 * m + term.cols - 2) / term.cols;
+  if (indexed)
+    for (int i = 2; i < m; i++)
+      sbsig_add(&qsig, pat[i - 2], pat[i - 1], pat[i]);
+  long long int candidate = LLONG_MIN / 2;
+  long long int sbtop = term.sbseq - term.sblines;
+
+  long long int y0 = begin / term.cols;
+  long long int y1 = (end - 1) / term.cols;
+  for (long long int y = y0; y <= y1; y++) {
+    if (indexed && y < term.sbseq) {
+      if (sbindex_candidate(y - sbtop, reach, &qsig))
+        candidate = y;
+      else if (y - candidate > reach) {
+        len = 0;
+        continue;
       }
-      line = fetch_line(y - term.sblines);
-      line_y = y;
     }
 
-    if (npos == 0 && cpos + term.results.xquery_length >= end) {
-      // Not enough data to match.
-      break;
-    }
+    termline * line = fetch_line(y - term.sbseq);
+    int x0 = y == y0 ? begin % term.cols : 0;
+    int x1 = y == y1 ? (end - 1) % term.cols + 1 : term.cols;
+    x1 = min(x1, (int)line->cols);
+    len += search_fold_line(line, y, x0, x1, text + len, cell + len);
+    release_line(line);
 
-    termchar * chr = line->chars + x;
-    xchar ch = chr->chr;
-    if (is_high_surrogate(chr->chr) && chr->cc_next) {
-      termchar * cc = chr + chr->cc_next;
-      if (is_low_surrogate(cc->chr)) {
-        ch = combine_surrogates(chr->chr, cc->chr);
-      }
-    }
-    xchar pat = term.results.xquery[npos];
-    bool match = case_fold(ch) == pat;
-    if (!match) {
-      // Skip the second cell of any wide characters
-      if (ch == UCSWIDE) {
-        ++anpos;
-        ++cpos;
-        continue;
+    int i = 0;
+    while (i + m <= len) {
+      xchar last = text[i + m - 1];
+      if (last == pat[m - 1] && !memcmp(text + i, pat, (m - 1) * sizeof(xchar))) {
+        // The match covers any wide character cells up to its last char
+        result run = {
+          .idx = cell[i],
+          .len = cell[i + m - 1] + 1 - cell[i]
+        };
+        assert(begin <= run.idx && (run.idx + run.len) <= end);
+        found(run);
+        i += m;
       }
-      cpos -= npos - 1;
-      npos = 0;
-      anpos = 0;
-      continue;
+      else
+        i += shift[search_shift_index(last)];
     }
 
-    ++anpos;
-    ++npos;
-
-    if (npos >= term.results.xquery_length) {
-      result run = {
-        .idx = cpos - anpos + 1,
-        .len = anpos
-      };
-      assert(begin <= run.idx && (run.idx + run.len) <= end);
-      // Append result
-      results_add(run);
-      npos = 0;
-      anpos = 0;
+    if (i < len) {
+      len -= i;
+      memmove(text, text + i, len * sizeof(xchar));
+      memmove(cell, cell + i, len * sizeof(long long int));
     }
-
-    ++cpos;
+    else
+      len = 0;
   }
 
   // Clean up
-  if (line) {
-      release_line(line);
-  }
+  free(text);
+  free(cell);
 }
 
 static void
@@ -784,35 +1461,79 @@ results_reverse(result *results, int len)
   }
 }
 
-static int imax(int a, int b) { return a < b ? b : a; }
-static int imin(int a, int b) { return a < b ? a : b; }
+static long long int llmax(long long int a, long long int b) { return a < b ? b : a; }
+static long long int llmin(long long int a, long long int b) { return a < b ? a : b; }
 
-// Ensure idx is covered by [range_begin, range_end)
-void
-term_search_expand(int idx)
+// Drop results of lines that have left the scrollback
+static void
+results_prune(void)
+{
+  long long int base = search_begin();
+  if (term.results.range_end <= base) {
+    term.results.range_begin = term.results.range_end = base;
+    term.results.length = 0;
+  }
+  else if (term.results.range_begin < base) {
+    int n = 0;
+    while (n < term.results.length && term.results.results[n].idx < base)
+      n++;
+    term.results.length -= n;
+    memmove(term.results.results, term.results.results + n,
+            term.results.length * sizeof(result));
+    term.results.range_begin = base;
+  }
+  if (term.results.current.len && term.results.current.idx < base)
+    term.results.current = (result) {0, 0};
+}
+
+/*
+   Search one slice of at most SEARCH_EXPAND_LINES lines towards idx, 
+   extending [range_begin, range_end); return whether idx is covered.
+ */
+#define SEARCH_EXPAND_LINES SEARCH_COUNT_LINES
+
+static bool
+search_expand_slice(long long int idx)
 {
-  int max_idx = term.cols * (term.sblines + term.rows);
-  idx = imin(idx, max_idx - 1);
-  idx = imax(idx, 0);
+  results_prune();
+  long long int min_idx = search_begin();
+  long long int max_idx = search_end();
+  idx = llmin(idx, max_idx - 1);
+  idx = llmax(idx, min_idx);
+  if (term.results.range_begin <= idx && idx < term.results.range_end)
+    return true;
 
-  // [range_1_begin, range_2_end) is the search region that covers [idx - look_around, idx + look_around)
+  // search [idx - look_around, idx + look_around), slice by slice
   int look_around = term.cols * term.rows;    // chosen arbitrarily
   int pad = term.results.xquery_length * 2;   // the doubling is for UCSWIDE
-  int range_1_begin = imax(idx - look_around - pad, 0);
-  int range_2_end = imin(idx + look_around + pad, max_idx);
+  long long int slice = (long long int)SEARCH_EXPAND_LINES * term.cols;
+
+  // Far away from the previous range, start a new one rather than 
+  // searching all the way to idx
+  if (term.results.range_begin != term.results.range_end
+      && (idx < term.results.range_begin - look_around - slice
+          || idx >= term.results.range_end + look_around + slice)) {
+    result current = term.results.current;
+    term_clear_results();
+    term.results.current = current;
+  }
 
-  // Previous range is empty, expand to [idx - look_around, idx + look_around).
+  // Previous range is empty, start it around idx.
   if (term.results.range_begin == term.results.range_end) {
     assert(term.results.length == 0);
-    do_search(range_1_begin, range_2_end);
-    term.results.range_begin = imax(idx - look_around, 0);
-    term.results.range_end = imin(idx + look_around, max_idx);
+    long long int around = llmin(look_around, slice / 2);
+    long long int begin = llmax(idx - around, min_idx);
+    long long int end = llmin(idx + around + 1, max_idx);
+    do_search(llmax(begin - pad, min_idx), llmin(end + pad, max_idx), results_add);
+    term.results.range_begin = begin;
+    term.results.range_end = end;
   }
   // Expand range_begin, and append the results to term.results.results.
   // (Actually the results should be prepended instead of appended, we'll fix that later.)
   else if (idx < term.results.range_begin) {
+    long long int begin = llmax(llmax(idx - look_around, term.results.range_begin - slice), min_idx);
     int previous_len = term.results.length;
-    do_search(range_1_begin, term.results.range_begin);
+    do_search(llmax(begin - pad, min_idx), term.results.range_begin, results_add);
 
     // The results from the expanding of range_begin were misplaced, fix it!
     int appended_len = term.results.length - previous_len;
@@ -826,23 +1547,24 @@ term_search_expand(int idx)
       // <Appended_results> <Previous_results>
     }
 
-    term.results.range_begin = imax(idx - look_around, 0);
+    term.results.range_begin = begin;
   }
   // Expand range_end, and append the results to term.results.results.
-  else if (idx >= term.results.range_end) {
-    do_search(term.results.range_end, range_2_end);
-    term.results.range_end = imin(idx + look_around, max_idx);
+  else {
+    long long int end = llmin(llmin(idx + look_around, term.results.range_end + slice), max_idx);
+    do_search(term.results.range_end, llmin(end + pad, max_idx), results_add);
+    term.results.range_end = end;
   }
 
   if (term.results.length > 0) {
     // Invariant: [range_begin, range_end) contains all results.
     result first = term.results.results[0];
     result last = term.results.results[term.results.length - 1];
-    term.results.range_begin = imin(term.results.range_begin, first.idx);
-    term.results.range_end = imax(term.results.range_end, last.idx + last.len);
+    term.results.range_begin = llmin(term.results.range_begin, first.idx);
+    term.results.range_end = llmax(term.results.range_end, last.idx + last.len);
 
     // Mark the current result (first result) if we can.
-    if (term.results.current.len == 0 && term.results.range_begin == 0) {
+    if (term.results.current.len == 0 && term.results.range_begin == min_idx) {
       term.results.current = first;
     }
   }
@@ -853,12 +1575,59 @@ term_search_expand(int idx)
     assert(prev.idx + prev.len <= term.results.results[i].idx);
     (void)prev;
   }
-  // Invariant: idx is covered by [range_begin, range_end).
-  assert(term.results.range_begin <= idx && idx < term.results.range_end);
+  return term.results.range_begin <= idx && idx < term.results.range_end;
+}
+
+// Ensure idx is covered by [range_begin, range_end)
+void
+term_search_expand(long long int idx)
+{
+  while (!search_expand_slice(idx))
+    ;
+}
+
+static bool
+search_expand_some(void)
+{
+  return search_expand_slice(expand_begin)
+      && search_expand_slice(expand_end - 1);
+}
+
+static void
+search_expand_cb(void)
+{
+  if (!expanding)
+    return;
+
+  ulong t0 = mtime();
+  bool done;
+  do
+    done = search_expand_some();
+  while (!done && mtime() - t0 < SEARCH_COUNT_TICKS);
+
+  expanding = !done;
+  if (expanding)
+    win_set_timer(search_expand_cb, 1);
+  win_schedule_update();
+}
+
+static void
+search_expand_display(void)
+{
+  if (!term.results.xquery_length) {
+    expanding = false;
+    return;
+  }
+  expand_begin = (term.sbseq + term.disptop) * term.cols;
+  expand_end = expand_begin + term.rows * term.cols;
+  if (!search_expand_some() && !expanding) {
+    expanding = true;
+    win_set_timer(search_expand_cb, 1);
+  }
 }
 
 static result
-results_find_ge(int idx)
+results_find_ge(long long int idx)
 {
   int b = 0;
   int e = term.results.length;
@@ -879,7 +1648,7 @@ results_find_ge(int idx)
 }
 
 static result
-results_find_le(int idx)
+results_find_le(long long int idx)
 {
   int b = 0;
   int e = term.results.length;
@@ -915,13 +1684,15 @@ term_search_next(void)
   uint64_t ts0 = rdtsc();
 #endif
 
+  results_prune();
   result current = term.results.current;
-  int max_idx = term.cols * (term.sblines + term.rows);
+  long long int min_idx = search_begin();
+  long long int max_idx = search_end();
 
   // Search the region after current result.
-  // If the current result was not marked, then idx == 0,
+  // If the current result was not marked, then idx == min_idx,
   // which means the upcoming search will return the first result in scrollback + screen.
-  int idx = current.idx + current.len;
+  long long int idx = current.len ? current.idx + current.len : min_idx;
   int cycle_count = 0;
   while (true) {
     // Expand range_end to cover idx.
@@ -941,7 +1712,7 @@ term_search_next(void)
     if (idx >= max_idx) {
       // End of screen reached.
       if (current.len == 0) {
-        // We have searched [0, max_idx), and no results were found.
+        // We have searched [min_idx, max_idx), and no results were found.
         break;
       } else {
         // BUG! Crossing the boundary twice.
@@ -954,8 +1725,8 @@ term_search_next(void)
       cycle_count++;
 
       // Search from the beginning.
-      idx = 0;
-      if (term.results.range_begin != 0) {
+      idx = min_idx;
+      if (term.results.range_begin != min_idx) {
         // Clear results before the next expansion to avoid full search.
         term_clear_results();
         // term.results.current should be preserved.
@@ -970,13 +1741,15 @@ term_search_next(void)
 result
 term_search_prev(void)
 {
+  results_prune();
   result current = term.results.current;
-  int max_idx = term.cols * (term.sblines + term.rows);
-  assert(max_idx > 0);
+  long long int min_idx = search_begin();
+  long long int max_idx = search_end();
+  assert(max_idx > min_idx);
 
   // Search the region before current result.
-  int idx = current.idx - 1;
-  if (idx < 0) {
+  long long int idx = current.idx - 1;
+  if (current.len == 0 || idx < min_idx) {
     idx = max_idx - 1;
   }
   int cycle_count = 0;
@@ -992,10 +1765,10 @@ term_search_prev(void)
     // Not covered, fall back idx to uncovered region.
     idx = term.results.range_begin - 1;
 
-    if (idx < 0) {
+    if (idx < min_idx) {
       // Beginning of scrollback or screen reached.
       if (current.len == 0) {
-        // We have searched [0, max_idx), and no results were found.
+        // We have searched [min_idx, max_idx), and no results were found.
         break;
       } else {
         // BUG! Crossing the boundary twice.
@@ -1021,18 +1794,132 @@ term_search_prev(void)
   return (result) {0, 0};
 }
 
+/*
+   Search the changed lines [l0, l1) again: replace the results that 
+   overlap them, or that a match extending into them could overlap, 
+   by a new search of that area, and recount matches from before it.
+ */
+static void
+search_refresh(long long int l0, long long int l1)
+{
+  results_prune();
+  long long int min_idx = search_begin();
+  long long int max_idx = search_end();
+  int cols = term.cols;
+  int reach = term.results.xquery_length * 2;   // the doubling is for UCSWIDE
+  if (term.results.regex_mode) {
+    // regular expression matches extend over wrapped lines only;
+    // the line after the changes may have lost its wrapped predecessor
+    reach = 0;
+    l0 = llmax(l0, min_idx / cols);
+    l1 = llmin(l1 + 1, max_idx / cols);
+    if (l0 < l1) {
+      l0 = term.sbseq + para_first(l0 - term.sbseq, -term.sblines);
+      l1 = term.sbseq + term_para_last(l1 - 1 - term.sbseq) + 1;
+    }
+  }
+  long long int begin = llmax(l0 * cols - reach, min_idx);
+  long long int end = llmin(l1 * cols + reach, max_idx);
+  if (begin >= end)
+    return;
+
+  count_rewind(begin);
+
+  // Results outside of [range_begin, range_end) are searched on demand
+  if (term.results.range_begin == term.results.range_end
+      || end <= term.results.range_begin || begin >= term.results.range_end)
+    return;
+
+  // Find the results overlapping [begin, end), and cover them as a whole
+  result * res = term.results.results;
+  int n = term.results.length;
+  int i0 = 0, i1 = n;
+  while (i0 < i1) {
+    int m = (i0 + i1) / 2;
+    if (res[m].idx + res[m].len <= begin)
+      i0 = m + 1;
+    else
+      i1 = m;
+  }
+  i1 = n;
+  for (int b = i0; b < i1;) {
+    int m = (b + i1) / 2;
+    if (res[m].idx < end)
+      b = m + 1;
+    else
+      i1 = m;
+  }
+  if (i0 < i1) {
+    begin = llmin(begin, res[i0].idx);
+    end = llmax(end, res[i1 - 1].idx + res[i1 - 1].len);
+  }
+
+  // Replace them with the results of a new search
+  int tail = n - i1;
+  result * saved = newn(result, tail + 1);
+  memcpy(saved, res + i1, tail * sizeof(result));
+  term.results.length = i0;
+  do_search(begin, end, results_add);
+  for (int i = 0; i < tail; i++)
+    results_add(saved[i]);
+  free(saved);
+
+  term.results.range_begin = llmin(term.results.range_begin, begin);
+  term.results.range_end = llmax(term.results.range_end, end);
+
+  // Keep the current result only if it is still there
+  result current = term.results.current;
+  if (current.len && current.idx < end && current.idx + current.len > begin) {
+    result found = results_find_ge(current.idx);
+    if (found.idx != current.idx || found.len != current.len)
+      term.results.current = (result) {0, 0};
+  }
+}
+
+void
+term_schedule_search_partial_update(void)
+{
+  if (term.results.update_type == NO_UPDATE)
+    term.results.update_type = PARTIAL_UPDATE;
+}
+
 void
 term_schedule_search_update(void)
 {
   term.results.update_type = FULL_UPDATE;
 }
 
+/*
+   Note that screen rows y0..y1 have changed, so that a partial update 
+   of the search only needs to search them again.
+ */
+void
+term_search_touch(int y0, int y1)
+{
+  if (!term.results.xquery_length)
+    return;
+  y0 = max(y0, 0);
+  y1 = min(y1, term.rows - 1);
+  if (y0 > y1)
+    return;
+  long long int l0 = term.sbseq + y0;
+  long long int l1 = term.sbseq + y1 + 1;
+  if (term.results.dirty_begin >= term.results.dirty_end) {
+    term.results.dirty_begin = l0;
+    term.results.dirty_end = l1;
+  }
+  else {
+    term.results.dirty_begin = min(term.results.dirty_begin, l0);
+    term.results.dirty_end = max(term.results.dirty_end, l1);
+  }
+}
+
 void
 term_clear_results(void)
 {
   term.results.results = renewn(term.results.results, 16);
   term.results.current = (result) {0, 0};
-  term.results.range_begin = term.results.range_end = 0;
+  term.results.range_begin = term.results.range_end = search_begin();
   term.results.length = 0;
   term.results.capacity = 16;
 }
@@ -1047,6 +1934,70 @@ term_clear_search(void)
   term.results.query = NULL;
   term.results.xquery = NULL;
   term.results.xquery_length = 0;
+  regex_free(term.results.rx);
+  term.results.rx = 0;
+  term.results.count = 0;
+  term.results.counting = false;
+  expanding = false;
+  term.results.dirty_begin = term.results.dirty_end = 0;
+  count_nmarks = 0;
+  count_ndrops = 0;
+  win_update_search_count();
+}
+
+/*
+   Scrollback memory accounting, in addition to the line limit;
+   the byte budget (MaxScrollbackKB) is applied to compressed lines
+   and the interned attributes they refer to.
+ */
+static void
+scrollback_account(uchar *cline, int sign)
+{
+  int cols;
+  term.sbbytes += sign * compressedsize(cline, &cols);
+  term.sbcells += sign * cols;
+}
+
+static long long int
+scrollback_budget(void)
+{
+  return cfg.max_scrollback_kb * 1024LL;
+}
+
+/* Compressed lines plus the attributes they share */
+static long long int
+scrollback_bytes(void)
+{
+  return term.sbbytes + attrtab_bytes();
+}
+
+/*
+   The scrollback buffer is a deque of fixed-size chunks of line pointers 
+   (see scrollback_line), so that it can grow, shrink and drop old lines 
+   without ever copying the whole index.
+ */
+static void
+scrollback_drop_oldest(void)
+{
+  count_drop();
+  uchar **cline = scrollback_line(0);
+  sbcache_drop(term.sbseq - term.sblines);
+  scrollback_account(*cline, -1);
+  freecompressedline(*cline);
+  term.sblines--;
+  if (term.sbpending)
+    term.sbpending--;
+  sbparas_drop(term.sbseq - term.sblines);
+  if (term.tempsblines > term.sblines)
+    term.tempsblines = term.sblines;
+  if (++term.sbfirst == SBCHUNK) {
+    // Release the emptied first chunk
+    sbindex_release(true);
+    free(term.scrollback[0]);
+    term.sbchunks--;
+    memmove(term.scrollback, term.scrollback + 1, term.sbchunks * sizeof(uchar **));
+    term.sbfirst = 0;
+  }
 }
 
 /*
@@ -1058,95 +2009,86 @@ static void
 scrollback_trim(void)
 {
   // Trim scrollback buffer back to max size after shunting reflow lines
-  //printf("scrollback_trim %p %d len %d lines %d tmp %d pos %d disp %d\n", line, newrows, term.sbsize, term.sblines, term.tempsblines, term.sbpos, term.disptop);
-  uchar **scrollback = newn(uchar *, cfg.scrollback_lines);
-  if (!scrollback)
-    return;
-  int new_sblines = 0;
-  for (int i = 0; i < term.sblines; i++) {
-    uchar *cline = term.scrollback[(i + term.sbpos) % term.sblines];
-    if (i < term.sblines - cfg.scrollback_lines)
-      free(cline);
-    else
-      scrollback[new_sblines++] = cline;
-  }
-  free(term.scrollback);
-  term.scrollback = scrollback;
-  term.sblines = new_sblines;
-  term.sbpos = new_sblines;
-  term.sbsize = cfg.scrollback_lines;
+  //printf("scrollback_trim len %d lines %d tmp %d first %d disp %d\n", term.sbchunks, term.sblines, term.tempsblines, term.sbfirst, term.disptop);
+  long long int budget = scrollback_budget();
+  while (term.sblines > cfg.scrollback_lines
+         || (budget && scrollback_bytes() > budget && term.sblines > 1)
+        )
+    scrollback_drop_oldest();
   term.tempsblines = term.sblines;
-
-  if (term.sbpos == term.sbsize)
-    term.sbpos = 0;
-  //printf("-> scrollback_trim len %d lines %d tmp %d pos %d disp %d\n", term.sbsize, term.sblines, term.tempsblines, term.sbpos, term.disptop);
+  //printf("-> scrollback_trim len %d lines %d tmp %d first %d disp %d\n", term.sbchunks, term.sblines, term.tempsblines, term.sbfirst, term.disptop);
 }
 
 static void
-scrollback_push(uchar *line, int newrows)
-{
-  //printf("scrollback_push %p %d len %d lines %d tmp %d pos %d disp %d\n", line, newrows, term.sbsize, term.sblines, term.tempsblines, term.sbpos, term.disptop);
-  if (term.sbpos == term.sbsize)
-    term.sbpos = 0;
-  if (term.sblines == term.sbsize) {
-    // Need to make space for the new line.
-    if (newrows || term.sbsize < cfg.scrollback_lines) {
-      assert(newrows || term.sbpos == 0);
-      // Expand buffer
-      int new_sbsize = newrows
-                      ? (term.sbsize + newrows) * 2
-                      : min(cfg.scrollback_lines, term.sbsize * 3 + 1024);
-      uchar **scrollback = renewn(term.scrollback, new_sbsize);
-      if (!scrollback)
-        goto scrollback_fallback;
-      if (term.sbpos) {
-        // Need to expand full buffer which may have wrapped around, so 
-        // we need to rebase the ring buffer for well-sorted linear expansion;
-        // use expanded part of buffer for shunting
-        for (int i = 0; i < term.sblines; i++)
-          scrollback[term.sbsize + i] = scrollback[(term.sbpos + i) % term.sbsize];
-        for (int i = 0; i < term.sblines; i++)
-          scrollback[i] = scrollback[term.sbsize + i];
-      }
-      term.scrollback = scrollback;
-      term.sbpos = term.sbsize;
-      term.sbsize = new_sbsize;
-    }
-    else
-  scrollback_fallback:  // whoo! this works
-    if (term.sblines) {
-      // Throw away the oldest line;
-      // sbpos needs to be normalized % sbsize here
-      free(term.scrollback[term.sbpos]);
-      term.sblines--;
-    }
+scrollback_push(uchar *line, termline *tline, int newrows)
+{
+  //printf("scrollback_push %p %d len %d lines %d tmp %d first %d disp %d\n", line, newrows, term.sbchunks, term.sblines, term.tempsblines, term.sbfirst, term.disptop);
+  if (!newrows && term.sblines >= cfg.scrollback_lines) {
+    // Need to make space for the new line; throw away the oldest line
+    if (term.sblines)
+      scrollback_drop_oldest();
     else {
+      freecompressedline(line);
+      return;
+    }
+  }
+
+  // Append a chunk if the last one is full
+  int pos = term.sbfirst + term.sblines;
+  if (pos / SBCHUNK == term.sbchunks) {
+    uchar **chunk = newn(uchar *, SBCHUNK);
+    uchar ***scrollback = renewn(term.scrollback, term.sbchunks + 1);
+    if (scrollback)
+      term.scrollback = scrollback;
+    if (!chunk || !scrollback) {
+      free(chunk);
+      freecompressedline(line);
       return;
     }
+    term.scrollback[term.sbchunks++] = chunk;
   }
-  assert(term.sblines < term.sbsize);
-  assert(term.sbpos < term.sbsize);
-  term.scrollback[term.sbpos++] = line;
-  if (term.sbpos == term.sbsize)
-    term.sbpos = 0;
+
+  term.scrollback[pos / SBCHUNK][pos % SBCHUNK] = line;
+  sbindex_push(pos, tline);
+  sbparas_push(term.sbseq, line);
   term.sblines++;
+  term.sbseq++;
   if (term.tempsblines < term.sblines)
     term.tempsblines++;
-  //printf("-> scrollback_push len %d lines %d tmp %d pos %d disp %d\n", term.sbsize, term.sblines, term.tempsblines, term.sbpos, term.disptop);
+  scrollback_account(line, 1);
+
+  // Enforce memory budget, unless shunting lines for reflow
+  long long int budget = scrollback_budget();
+  if (budget && !newrows)
+    while (scrollback_bytes() > budget && term.sblines > 1)
+      scrollback_drop_oldest();
+  //printf("-> scrollback_push len %d lines %d tmp %d first %d disp %d\n", term.sbchunks, term.sblines, term.tempsblines, term.sbfirst, term.disptop);
 }
 
 static uchar *
 scrollback_pop(void)
 {
   assert(term.sblines > 0);
-  assert(term.sbpos < term.sbsize);
   term.sblines--;
+  term.sbseq--;
+  term.sbpending = min(term.sbpending, term.sblines);
+  sbcache_drop(term.sbseq);
   if (term.tempsblines)
     term.tempsblines--;
-  if (term.sbpos == 0)
-    term.sbpos = term.sbsize;
-  //printf("-> scrollback_pop len %d lines %d tmp %d pos %d disp %d\n", term.sbsize, term.sblines, term.tempsblines, term.sbpos - 1, term.disptop);
-  return term.scrollback[--term.sbpos];
+  uchar *cline = *scrollback_line(term.sblines);
+  scrollback_account(cline, -1);
+  sbparas_pop(term.sbseq);
+
+  // Release unused chunks at the end, but keep one spare
+  // to avoid thrashing when pushing and popping around a chunk boundary
+  int used = (term.sbfirst + term.sblines + SBCHUNK - 1) / SBCHUNK;
+  while (term.sbchunks > used + 1)
+    free(term.scrollback[--term.sbchunks]);
+  sbindex_release(false);
+  // the end of the preceding line is not known any more
+  sbindex.ntail = -1;
+  //printf("-> scrollback_pop len %d lines %d tmp %d first %d disp %d\n", term.sbchunks, term.sblines, term.tempsblines, term.sbfirst, term.disptop);
+  return cline;
 }
 
 /*
@@ -1155,23 +2097,28 @@ scrollback_pop(void)
 void
 term_clear_scrollback(void)
 {
+  // keep absolute line numbers of the screen (and search positions) valid
+  long long int sbseq = term.sbseq;
   while (term.sblines)
-    free(scrollback_pop());
+    freecompressedline(scrollback_pop());
+  term.sbseq = sbseq;
+  sbcache_clear();
+  sbindex_clear();
+  sbparas_clear();
+  while (term.sbchunks)
+    free(term.scrollback[--term.sbchunks]);
   free(term.scrollback);
   term.scrollback = 0;
-  term.sbsize = term.sblines = term.sbpos = 0;
+  term.sblines = term.sbfirst = 0;
   term.tempsblines = 0;
+  term.sbpending = 0;
+  term.sbbytes = term.sbcells = 0;
   term.disptop = 0;
+  term_schedule_search_update();
 }
 
 #define dont_debug_scrollback 1
 
-// mark cursor position in order not to lose it during reflow
-#define TATTR_MARKCURS (TATTR_ACTCURS | TATTR_PASCURS)
-// determine effective line length trimmed to printed characters;
-// need to include ATTR_BOLD | ATTR_DIM for proper TAB unwrapping
-// need to include TATTR_MARKCURS for proper detection of final cursor
-#define attr_clear(attr) ((attr & (TATTR_CLEAR | ATTR_BOLD | ATTR_DIM | TATTR_MARKCURS)) == TATTR_CLEAR)
 
 #ifdef debug_scrollback
 
@@ -1193,9 +2140,9 @@ printline(char * tag, termline * tl, int col)
 static void
 printsb(char * tag)
 {
-  printf("sb %s[%d@%d]-------------\n", tag, term.sblines, term.sbpos);
+  printf("sb %s[%d@%d]-------------\n", tag, term.sblines, term.sbfirst);
   for (int i = 0; i < term.sblines; i++) {
-    uchar *cline = term.scrollback[(i + term.sbpos) % term.sblines];
+    uchar *cline = *scrollback_line(i);
     termline *line = decompressline(cline, null);
     printline("=", line, -1);
     freeline(line);
@@ -1222,64 +2169,62 @@ printsc(char * tag, char * ltag, termline **lines, int rows)
 #define dont_debug_reflow
 
 /*
- * Line rebreaking for screen and scrollback lines
+   Rewrapped lines are pushed to the scrollback buffer, or collected 
+   in reflow_out while a part of it is rewrapped in place (rewrap_pending).
  */
+static struct {
+  bool collect;
+  uchar ** lines;
+  int len, size;
+} reflow_out;
+
 static void
-term_reflow(int newrows, int newcols, bool quick_reflow)
+reflow_push(uchar * cline)
 {
-  trace_resize(("----- term_reflow %d %d quick %d\n", newrows, newcols, quick_reflow));
-#ifdef debug_reflow
-  ulong t0 = mtime();
-#endif
-  // First, mark the current cursor position;
-  // also clear old marks elsewhere;
-  // to be sure to catch the cursor position, use the new height 
-  // (lines have already been rearranged) and respective widths of each line;
-  // in case of remaining problems, we couldl further move this marking 
-  // to the beginning of term_resize()
-  for (int i = newrows - 1; i >= 0; i--)
-    for (int j = term.lines[i]->cols - 1; j >= 0; j--)
-      if (i == term.curs.y && j == term.curs.x)
-        term.lines[i]->chars[j].attr.attr |= TATTR_MARKCURS;
-      else
-        term.lines[i]->chars[j].attr.attr &= ~TATTR_MARKCURS;
-
-  // Push all screen lines to scrollback buffer
-  for (int i = 0; i < newrows; i++) {
-    termline *line = term.lines[i];
-    scrollback_push(compressline(line), newrows);
-    freeline(line);
+  if (!reflow_out.collect) {
+    scrollback_push(cline, null, true);
+    return;
   }
-  printsb("<rewrap");
-
-  // Handle old scrollback buffer in local variables
-  // so we can use scrollback_push to store it back 
-  // with implicit size management
-  uchar **scrollback = term.scrollback;
-  int sbpos = term.sbpos;
-  int sblines = term.sblines;
-  // Reset scrollback buffer (don't clear contents, which we hold locally)
-  term.scrollback = 0;
-  term.sbsize = term.sblines = term.sbpos = 0;
-  term.tempsblines = 0;
+  if (reflow_out.len == reflow_out.size) {
+    int size = reflow_out.size ? reflow_out.size * 2 : 256;
+    uchar ** lines = renewn(reflow_out.lines, size);
+    if (!lines) {
+      freecompressedline(cline);
+      return;
+    }
+    reflow_out.lines = lines;
+    reflow_out.size = size;
+  }
+  reflow_out.lines[reflow_out.len++] = cline;
+}
 
-  int cursor_scrolled = 0;
+/*
+   Rewrap lines [from, to) of a scrollback buffer (holding sblines lines) 
+   to newcols, pushing the result with reflow_push (shunting them to the 
+   scrollback buffer, the caller trims it afterwards);
+   [from, to) must not split a group of wrapped lines.
+   The rows of a rewrapped group get the line attributes of its first 
+   line, and the progress and scroll marks of any of its lines, so they 
+   do not depend on the widths the group has been rewrapped to before.
+   The last newrows lines are screen lines, which are checked for the 
+   cursor mark; *cursor_scrolled counts the lines pushed after it.
+ */
+static void
+reflow_lines(uchar ***scrollback, int sbfirst, int sblines, int from, int to,
+             int newrows, int newcols, int * cursor_scrolled)
+{
   void cursor_scroll(termline *tl)
   {
     for (int k = 0; k < tl->cols; k++)
       if (tl->chars[k].attr.attr & TATTR_MARKCURS) {
-        cursor_scrolled = 0;
+        *cursor_scrolled = 0;
         break;
       }
-    cursor_scrolled ++;
+    (*cursor_scrolled) ++;
   }
-#ifdef debug_reflow
-  ulong t1 = mtime();
-#endif
 
-  // Reflow scrollback buffer
-  int i = 0;
-  while (i < sblines) {
+  int i = from;
+  while (i < to) {
 #ifdef wrapbuf
 #warning missing wrap buffer size management
     termline *linebuf[99];  // wrap buffer
@@ -1289,61 +2234,67 @@ term_reflow(int newrows, int newcols, bool quick_reflow)
     termline * inbuf;
 #endif
 
-    // fetch (without resizeline)
-    uchar *cline = scrollback[(i + sbpos) % sblines];
-    inbuf = decompressline(cline, null);
-    int actcols = inbuf->cols;
-    // determine actual non-empty columns
-    while (actcols && attr_clear(inbuf->chars[actcols - 1].attr.attr))
-      actcols --;
-
-    // Quick reflow: for continuous reflow while resizing, 
-    // reflow must be quicker; we only reflow the bottommost lines
-    if (quick_reflow) {
-      // TODO: do not split handling for wrapped lines
-      // TODO: check rewrap artefacts
-      if (i < sblines - 2 * max(term.rows, newrows)) {
-        // skip reflow for all but the bottommost lines
-        scrollback_push(cline, newrows);
+    // check line header (without decompressline)
+    uchar *cline = *sbchunkline(scrollback, sbfirst, i);
+    int cols, actcols;  // actual non-empty columns
+    ushort lattr = compressedlattr(cline, &cols, &actcols);
+    // the screen lines need to be checked for the cursor mark
+    bool screen = i >= sblines - newrows;
 
-        cursor_scroll(inbuf);
-        freeline(inbuf);
-
-        i ++;
-        continue;
-      }
-    }
-
-    if ((!(inbuf->lattr & LATTR_WRAPPED) && actcols <= newcols)
-        || !(inbuf->lattr & LATTR_REWRAP)
+    if ((!(lattr & LATTR_WRAPPED) && actcols <= newcols)
+        || !(lattr & LATTR_REWRAP)
        )
     {
       // shortcut: skip multiple lines handling
 
-      if (newcols <= inbuf->cols)
-        // skip compressline()
-        scrollback_push(cline, newrows);
-      else {  // need to resizeline when widening
-        free(cline);
-        resizeline(inbuf, newcols);
-        scrollback_push(compressline(inbuf), newrows);
+      // A line narrower than the terminal is widened when fetched;
+      // only if scrollback memory is limited, widen it here already, 
+      // to account for its size as after a full reflow
+      bool widen = newcols > cols && (screen || scrollback_budget());
+      if (screen || widen) {
+        inbuf = decompressline(cline, null);
+        if (widen) {  // need to resizeline when widening
+          freecompressedline(cline);
+          resizeline(inbuf, newcols);
+          cline = compressline(inbuf);
+        }
+        cursor_scroll(inbuf);
+        freeline(inbuf);
       }
-      cursor_scroll(inbuf);
-      freeline(inbuf);
+      else
+        (*cursor_scrolled) ++;
+      // skip compressline() unless widened
+      reflow_push(cline);
 
       i ++;
       continue;
     }
 
-    free(cline);
+    ushort marks = 0;
+    for (int k = i; k < to; k++) {
+      int kcols, kused;
+      ushort kattr = k == i ? lattr : 
+        compressedlattr(*sbchunkline(scrollback, sbfirst, k), &kcols, &kused);
+      if (k > i && !(kattr & LATTR_WRAPCONTD))
+        break;
+      marks |= kattr & (LATTR_PROGRESS | LATTR_MARKED | LATTR_UNMARKED);
+      if (!(kattr & LATTR_WRAPPED))
+        break;
+    }
+    ushort rowattr = (lattr & ~(LATTR_WRAPPED | LATTR_WRAPPED2 | LATTR_WRAPCONTD
+                                | LATTR_PROGRESS | LATTR_MARKED | LATTR_UNMARKED))
+                     | (marks & LATTR_PROGRESS);
+
+    inbuf = decompressline(cline, null);
+    freecompressedline(cline);
 
     int j = 0;  // wrapped lines (buffer) counter
 #ifdef wrapbuf
-    while ((linebuf[j]->lattr & LATTR_WRAPPED) && i + j + 1 < sblines) {
+    while ((linebuf[j]->lattr & LATTR_WRAPPED) && i + j + 1 < to) {
       j++;
-      uchar *cline = scrollback[(i + j + sbpos) % sblines];
+      uchar *cline = *sbchunkline(scrollback, sbfirst, i + j);
       linebuf[j] = decompressline(cline, null);
-      free(cline);
+      freecompressedline(cline);
       if (!(linebuf[j]->lattr & LATTR_WRAPCONTD)) {
         // drop non-continuing line (could save for later)
         freeline(linebuf[j]);
@@ -1359,7 +2310,7 @@ term_reflow(int newrows, int newcols, bool quick_reflow)
 #ifdef skip_rewrap
     // ignore rewrap and clear out input wrap buffer, for testing
     for (int jj = 0; jj <= j; jj++) {
-      scrollback_push(compressline(linebuf[jj]), newrows);
+      reflow_push(compressline(linebuf[jj]));
       cursor_scroll(linebuf[jj]);
       freeline(linebuf[jj]);
     }
@@ -1377,19 +2328,19 @@ term_reflow(int newrows, int newcols, bool quick_reflow)
 #else
 #ifdef skip_rewrap
     // ignore rewrap and clear out input wrap buffer, for testing
-    scrollback_push(compressline(inbuf), newrows);
+    reflow_push(compressline(inbuf));
     freeline(inbuf);
     goto wrapped;
 #endif
 
     bool advance_inbuf()
     {
-      if ((inbuf->lattr & LATTR_WRAPPED) && i + j + 1 < sblines) {
+      if ((inbuf->lattr & LATTR_WRAPPED) && i + j + 1 < to) {
         // drop current line
         freeline(inbuf);
         // advance to next line
         j++;
-        uchar *cline = scrollback[(i + j + sbpos) % sblines];
+        uchar *cline = *sbchunkline(scrollback, sbfirst, i + j);
         inbuf = decompressline(cline, null);
         //free(cline) unless the fetch is reverted...
         if (!(inbuf->lattr & LATTR_WRAPCONTD)) {
@@ -1405,7 +2356,7 @@ term_reflow(int newrows, int newcols, bool quick_reflow)
           return false;
         }
         else {
-          free(cline);
+          freecompressedline(cline);
           return true;
         }
       }
@@ -1438,7 +2389,7 @@ term_reflow(int newrows, int newcols, bool quick_reflow)
         // flush current outbuf line, then make a new one
         if (lout >= 0) {
           outbuf->lattr |= LATTR_WRAPPED;
-          scrollback_push(compressline(outbuf), newrows);
+          reflow_push(compressline(outbuf));
           term.virtuallines++;
           cursor_scroll(outbuf);
           //printline("↑", outbuf, -1);
@@ -1448,16 +2399,18 @@ term_reflow(int newrows, int newcols, bool quick_reflow)
         // make a new outbuf line
         lout = 0;
         outbuf = newline(newcols, true);
-        outbuf->lattr = inbuf->lattr & ~(LATTR_WRAPPED | LATTR_WRAPPED2 | LATTR_WRAPCONTD);
+        outbuf->lattr = rowattr;
         // position output column
         if (incol >= 0) {
           // subsequent lines
           outcol = 0;
           outbuf->lattr |= LATTR_WRAPCONTD;
         }
-        else
+        else {
           // first line
           outcol = -1;  // include initial combining character
+          outbuf->lattr |= marks & (LATTR_MARKED | LATTR_UNMARKED);
+        }
 
         // char copy follows line allocation => last wrapped line is not empty
       }
@@ -1478,7 +2431,7 @@ term_reflow(int newrows, int newcols, bool quick_reflow)
     } while (true);
     // flush last outbuf line
     if (outbuf) {
-      scrollback_push(compressline(outbuf), newrows);
+      reflow_push(compressline(outbuf));
       cursor_scroll(outbuf);
       //printline("↑", outbuf, -1);
       freeline(outbuf);
@@ -1492,6 +2445,100 @@ term_reflow(int newrows, int newcols, bool quick_reflow)
     i += j + 1;
     term.virtuallines -= j;
   }
+}
+
+/*
+ * Line rebreaking for screen and scrollback lines
+ */
+static void
+term_reflow(int newrows, int newcols, bool quick_reflow)
+{
+  trace_resize(("----- term_reflow %d %d quick %d\n", newrows, newcols, quick_reflow));
+#ifdef debug_reflow
+  ulong t0 = mtime();
+#endif
+  // First, mark the current cursor position;
+  // also clear old marks elsewhere;
+  // to be sure to catch the cursor position, use the new height 
+  // (lines have already been rearranged) and respective widths of each line;
+  // in case of remaining problems, we couldl further move this marking 
+  // to the beginning of term_resize()
+  for (int i = newrows - 1; i >= 0; i--)
+    for (int j = term.lines[i]->cols - 1; j >= 0; j--)
+      if (i == term.curs.y && j == term.curs.x)
+        term.lines[i]->chars[j].attr.attr |= TATTR_MARKCURS;
+      else
+        term.lines[i]->chars[j].attr.attr &= ~TATTR_MARKCURS;
+
+  // Lines are rewrapped, so the search index would be void
+  sbindex_clear();
+
+  // Push all screen lines to scrollback buffer
+  for (int i = 0; i < newrows; i++) {
+    termline *line = term.lines[i];
+    scrollback_push(compressline(line), null, newrows);
+    freeline(line);
+  }
+  printsb("<rewrap");
+
+  // Handle old scrollback buffer in local variables
+  // so we can use scrollback_push to store it back 
+  // with implicit size management
+  uchar ***scrollback = term.scrollback;
+  int sbchunks = term.sbchunks;
+  int sbfirst = term.sbfirst;
+  int sblines = term.sblines;
+  // Reset scrollback buffer (don't clear contents, which we hold locally)
+  sbcache_clear();
+  sbparas_clear();
+  term.scrollback = 0;
+  term.sbchunks = term.sblines = term.sbfirst = 0;
+  term.tempsblines = 0;
+  term.sbpending = 0;
+  term.sbbytes = term.sbcells = 0;
+
+  int cursor_scrolled = 0;
+#ifdef debug_reflow
+  ulong t1 = mtime();
+#endif
+
+  // Reflow the screen and the scrollback around the display eagerly;
+  // older lines keep the width they were stored at until they are 
+  // accessed (term_rewrap_pending); for continuous reflow while resizing,
+  // reflow must be quicker, so we only reflow the bottommost lines
+  int window = 2 * max(term.rows, newrows);
+  if (!quick_reflow)
+    window -= term.disptop;
+  // count the window in rewrapped rows, estimated from the line headers, 
+  // so widening does not leave the screen short of rewrapped lines;
+  // stop only at the start of a group of wrapped lines
+  int pending = sblines;
+  int rows = 0, groupcols = 0;
+  while (pending > 0 && rows < window) {
+    int cols, actcols;
+    pending--;
+    ushort lattr =
+      compressedlattr(*sbchunkline(scrollback, sbfirst, pending),
+                      &cols, &actcols);
+    groupcols += lattr & LATTR_WRAPPED ? cols : actcols;
+    if (pending && lattr & LATTR_WRAPCONTD) {
+      int prevcols, prevactcols;
+      if (compressedlattr(*sbchunkline(scrollback, sbfirst, pending - 1),
+                          &prevcols, &prevactcols) & LATTR_WRAPPED)
+        continue;
+    }
+    rows += max(1, (groupcols + newcols - 1) / newcols);
+    groupcols = 0;
+  }
+  for (int i = 0; i < pending; i++) {
+    scrollback_push(*sbchunkline(scrollback, sbfirst, i), null, newrows);
+    cursor_scrolled ++;
+  }
+  reflow_lines(scrollback, sbfirst, sblines, pending, sblines, 
+               newrows, newcols, &cursor_scrolled);
+  term.sbpending = pending;
+  for (int i = 0; i < sbchunks; i++)
+    free(scrollback[i]);
   free(scrollback);
   printsb(">rewrap");
 #ifdef debug_reflow
@@ -1506,8 +2553,8 @@ term_reflow(int newrows, int newcols, bool quick_reflow)
   // this could be changed to a forward approach (reducing image searches) 
   // if images already handled were remembered in a cache, or marked in 
   // the image list somehow...
-  for (int i = term.sblines - 1; i >= 0; i--) {
-    uchar *cline = term.scrollback[(i + term.sbpos) % term.sblines];
+  for (int i = term.imgs.first ? term.sblines - 1 : -1; i >= 0; i--) {
+    uchar *cline = *scrollback_line(i);
     termline *line = decompressline(cline, null);
     for (int j = line->cols - 1; j >= 0; j--) {
       termchar * tc = &line->chars[j];
@@ -1530,8 +2577,8 @@ term_reflow(int newrows, int newcols, bool quick_reflow)
     if (changed_line) {
       uchar * nline = compressline(line);
       if (nline) {
-        term.scrollback[(i + term.sbpos) % term.sblines] = nline;
-        free(cline);
+        *scrollback_line(i) = nline;
+        freecompressedline(cline);
       }
     }
 #endif
@@ -1567,7 +2614,7 @@ term_reflow(int newrows, int newcols, bool quick_reflow)
       termline *line = decompressline(cline, null);
       resizeline(line, newcols);  // to be safe; probably not needed here
       //printline("↓", line, -1);
-      free(cline);
+      freecompressedline(cline);
       line->temporary = false;  /* reconstituted line is now real */
       // don't free(term.lines[i]);  // freed above (pushing all screen lines)
       term.lines[i] = line;
@@ -1616,6 +2663,187 @@ term_reflow(int newrows, int newcols, bool quick_reflow)
   }
 }
 
+/*
+   Rewrap the pending scrollback lines [from, term.sbpending), which 
+   term_reflow left at their old width, in place; from must be the start 
+   of a paragraph. The later lines keep their place and absolute number 
+   (term.sbseq), the older lines are moved and renumbered.
+ */
+static void
+rewrap_pending(int from)
+{
+  int pending = term.sbpending;
+  if (from >= pending)
+    return;
+  term.sbpending = from;
+  // line positions of the search count are void
+  count_void();
+  sbcache_clear();
+  sbindex_clear();
+
+  int sblines = term.sblines;
+  int tempsblines = term.tempsblines;
+  for (int i = from; i < pending; i++)
+    scrollback_account(*scrollback_line(i), -1);
+  reflow_out.collect = true;
+  reflow_out.len = 0;
+  int cursor_scrolled = 0;
+  reflow_lines(term.scrollback, term.sbfirst, sblines, from, pending, 
+               0, term.cols, &cursor_scrolled);
+  reflow_out.collect = false;
+  uchar ** lines = reflow_out.lines;
+  int n = reflow_out.len;
+
+  // Make room at the front for additional lines, 
+  // or drop the oldest rewrapped lines if that fails
+  int d = n - (pending - from);
+  while (term.sbfirst < d) {
+    uchar ** chunk = newn(uchar *, SBCHUNK);
+    uchar *** scrollback = chunk ? renewn(term.scrollback, term.sbchunks + 1) : 0;
+    if (!scrollback) {
+      free(chunk);
+      int drop = d - term.sbfirst;
+      for (int i = 0; i < drop; i++)
+        freecompressedline(lines[i]);
+      lines += drop;
+      n -= drop;
+      d -= drop;
+      break;
+    }
+    term.scrollback = scrollback;
+    memmove(scrollback + 1, scrollback, term.sbchunks++ * sizeof(uchar **));
+    scrollback[0] = chunk;
+    term.sbfirst += SBCHUNK;
+  }
+
+  // Move the older lines, fill in the rewrapped lines
+  int first = term.sbfirst - d;
+  if (d > 0)
+    for (int i = 0; i < from; i++)
+      *sbchunkline(term.scrollback, first, i) = 
+        *sbchunkline(term.scrollback, term.sbfirst, i);
+  else if (d < 0)
+    for (int i = from; i-- > 0;)
+      *sbchunkline(term.scrollback, first, i) = 
+        *sbchunkline(term.scrollback, term.sbfirst, i);
+  for (int i = 0; i < n; i++) {
+    *sbchunkline(term.scrollback, first, from + i) = lines[i];
+    scrollback_account(lines[i], 1);
+  }
+  term.sbfirst = first;
+  term.sblines += d;
+  // Release emptied chunks at the front
+  while (term.sbfirst >= SBCHUNK) {
+    free(term.scrollback[0]);
+    term.sbchunks--;
+    memmove(term.scrollback, term.scrollback + 1, term.sbchunks * sizeof(uchar **));
+    term.sbfirst -= SBCHUNK;
+  }
+
+  // Renumber the paragraph starts of the older lines, 
+  // replace those of the rewrapped lines
+  if (sbparas.valid) {
+    long long int top = term.sbseq - sblines;
+    int i0 = sbparas_find(top + from - 1);
+    int i1 = sbparas_find(top + pending - 1);
+    int nstarts = 0;
+    for (int i = 0; i < n; i++) {
+      int cols, used;
+      if (!i || !(compressedlattr(lines[i - 1], &cols, &used) & LATTR_WRAPPED))
+        nstarts++;
+    }
+    int len = i0 + nstarts + sbparas.len - i1;
+    long long int * starts = newn(long long int, max(len, 1));
+    if (!starts) {
+      sbparas_clear();
+      sbparas.valid = false;
+    }
+    else {
+      long long int * old = sbparas.starts + sbparas.first;
+      for (int i = 0; i < i0; i++)
+        starts[i] = old[i] - d;
+      int k = i0;
+      for (int i = 0; i < n; i++) {
+        int cols, used;
+        if (!i || !(compressedlattr(lines[i - 1], &cols, &used) & LATTR_WRAPPED))
+          starts[k++] = top - d + from + i;
+      }
+      memcpy(starts + k, old + i1, (sbparas.len - i1) * sizeof(long long int));
+      free(sbparas.starts);
+      sbparas.starts = starts;
+      sbparas.first = 0;
+      sbparas.len = sbparas.size = len;
+      if (pending == sblines && n) {
+        int cols, used;
+        sbparas.wrapped = compressedlattr(lines[n - 1], &cols, &used) & LATTR_WRAPPED;
+      }
+    }
+  }
+
+  scrollback_trim();
+  // the screen can still retrieve the same most recent lines
+  term.tempsblines = min(tempsblines, term.sblines);
+
+  // Keep the display and selection on the older lines
+  int from_y = from - sblines;
+  if (term.disptop <= from_y)
+    term.disptop = max(term.disptop - d, -term.sblines);
+  void move_pos(pos * p) {
+    if (p->y < from_y)
+      p->y = max(p->y - d, -term.sblines);
+  }
+  move_pos(&term.sel_start);
+  move_pos(&term.sel_end);
+  move_pos(&term.sel_anchor);
+  move_pos(&term.sel_pos);
+
+  term_schedule_search_update();
+}
+
+/*
+   Rewrap all pending lines, before they are searched or copied.
+ */
+void
+term_rewrap_pending(void)
+{
+  rewrap_pending(0);
+}
+
+/*
+   Rewrap the pending lines that are displayed, lazily: a slice of 
+   whole paragraphs of about REWRAP_SLICE lines at a time, going back 
+   from the most recent pending lines; further slices are rewrapped 
+   by timer ticks of at most REWRAP_TICKS ms.
+   Return whether pending lines are still displayed.
+ */
+#define REWRAP_SLICE 1024
+#define REWRAP_TICKS 20
+
+static bool
+rewrap_display(void)
+{
+  if (!sblines() || term.disptop >= term.sbpending - term.sblines)
+    return false;
+  int from = max(0, term.sbpending - REWRAP_SLICE);
+  if (from)
+    from = para_first(from - term.sblines, -term.sblines) + term.sblines;
+  rewrap_pending(from);
+  return sblines() && term.disptop < term.sbpending - term.sblines;
+}
+
+static void
+rewrap_cb(void)
+{
+  ulong t0 = mtime();
+  bool more;
+  do
+    more = rewrap_display();
+  while (more && mtime() - t0 < REWRAP_TICKS);
+  if (more)
+    win_set_timer(rewrap_cb, 1);
+  win_schedule_update();
+}
+
 /*
  * Set up the terminal for a given size.
  */
@@ -1624,6 +2852,8 @@ term_resize(int newrows, int newcols, bool quick_reflow)
 {
   trace_resize(("--- term_resize %d %d quick %d\n", newrows, newcols, quick_reflow));
 
+  count_void();
+
   bool on_alt_screen = term.on_alt_screen;
   term_switch_screen(0, false);
 
@@ -1691,7 +2921,7 @@ term_resize(int newrows, int newcols, bool quick_reflow)
     // Push removed lines into scrollback
     for (int i = 0; i < store; i++) {
       termline *line = lines[i];
-      scrollback_push(compressline(line), 0);
+      scrollback_push(compressline(line), line, 0);
       term.virtuallines++;
       freeline(line);
     }
@@ -1731,7 +2961,7 @@ term_resize(int newrows, int newcols, bool quick_reflow)
     for (int i = restore; i--;) {
       uchar *cline = scrollback_pop();
       termline *line = decompressline(cline, null);
-      free(cline);
+      freecompressedline(cline);
       line->temporary = false;  /* reconstituted line is now real */
       lines[i] = line;
     }
@@ -1798,6 +3028,10 @@ term_resize(int newrows, int newcols, bool quick_reflow)
   term.rows0 = newrows;
   term.cols0 = newcols;
 
+  // Adapt scrollback line cache and search index to new size
+  sbcache_clear();
+  sbindex_clear();
+
   // Status area handling
 
   // limit status size
@@ -1880,6 +3114,8 @@ term_switch_screen(bool to_alt, bool reset)
   term.imgs.altlast = last;
   term.altvirtuallines = offset;
 
+  term_search_touch(0, term.rows - 1);
+
   if (to_alt && reset)
     term_erase(false, false, true, true);
 }
@@ -2041,6 +3277,7 @@ term_check_boundary(int x, int y)
     return;
 
   termline *line = term.lines[y];
+  touch_line(line);
   if (x == term.cols)
     line->lattr &= ~LATTR_WRAPPED2;
   else if (line->chars[x].chr == UCSWIDE) {
@@ -2054,77 +3291,6 @@ term_check_boundary(int x, int y)
 }
 
 
-#ifdef use_display_scrolling
-
-/*
-   Scroll the actual display (window contents and its cache).
-   NOTE: This was an incomplete and initially unsuccessful attempt 
-   to implement smooth scrolling (DECSCLM, DECSET 4).
- */
-static int dispscroll_top, dispscroll_bot, dispscroll_lines = 0;
-
-static void
-disp_scroll(int topscroll, int botscroll, int scrolllines)
-{
-  if (dispscroll_lines) {
-    dispscroll_lines += scrolllines;
-    dispscroll_top = (dispscroll_top + topscroll) / 2;
-    dispscroll_bot = (dispscroll_bot + botscroll) / 2;
-  }
-  else {
-    dispscroll_top = topscroll;
-    dispscroll_bot = botscroll;
-    dispscroll_lines = scrolllines;
-  }
-}
-
-/*
-   Perform actual display scrolling.
-   Invoke window scrolling and if successful, adjust display cache.
- */
-static void
-disp_do_scroll(int topscroll, int botscroll, int scrolllines)
-{
-  bool down = scrolllines < 0;
-  int lines = min(abs(scrolllines), term.rows);
-
-  if (!win_do_scroll(topscroll, botscroll, lines))
-    return;
-
-  // update display cache
-  termline * recycled[lines];
-  if (down) {
-    for (int l = 0; l < lines; l++) {
-      recycled[l] = term.displines[botscroll - 1 - l];
-      clearline(recycled[l]);
-      for (int j = 0; j < term.cols; j++)
-        recycled[l]->chars[j].attr.attr |= ATTR_INVALID;
-    }
-    for (int l = botscroll - 1; l >= topscroll + lines; l--) {
-      term.displines[l] = term.displines[l - lines];
-    }
-    for (int l = 0; l < lines; l++) {
-      term.displines[topscroll + l] = recycled[l];
-    }
-  }
-  else {
-    for (int l = 0; l < lines; l++) {
-      recycled[l] = term.displines[topscroll + l];
-      clearline(recycled[l]);
-      for (int j = 0; j < term.cols; j++)
-        recycled[l]->chars[j].attr.attr |= ATTR_INVALID;
-    }
-    for (int l = topscroll; l < botscroll - lines; l++) {
-      term.displines[l] = term.displines[l + lines];
-    }
-    for (int l = 0; l < lines; l++) {
-      term.displines[botscroll - 1 - l] = recycled[l];
-    }
-  }
-}
-
-#endif
-
 /*
  * Scroll the screen. (`lines' is +ve for scrolling forward, -ve
  * for backward.) `sb' is true if the scrolling is permitted to
@@ -2150,15 +3316,12 @@ term_do_scroll(int topline, int botline, int lines, bool sb)
     return;
   }
 
-#ifdef use_display_scrolling
-  int scrolllines = lines;
-#endif
-
   markpos_valid = false;
   assert(botline >= topline && lines != 0);
 
   bool down = lines < 0; // Scrolling downwards?
   lines = abs(lines);    // Number of lines to scroll by
+  long long int sbseq = term.sbseq;
 
   lines_scrolled += lines;
 
@@ -2176,17 +3339,12 @@ term_do_scroll(int topline, int botline, int lines, bool sb)
   termline **top = term.lines + topline;
   termline **bot = term.lines + botline;
 
-#ifdef use_display_scrolling
-  // Screen scrolling
-  int topscroll = topline - term.disptop;
-  if (topscroll < term.rows) {
-    int botscroll = min(botline - term.disptop, term.rows);
-    if (!down && term.disptop && !topline)
-      ; // ignore bottom forward scroll if scrolled back
-    else
-      disp_scroll(topscroll, botscroll, scrolllines);
-  }
-#endif
+  // Note the move of visible contents, unless the view stays 
+  // in the scrollback while lines are pushed into it
+  int disptopline = topline - term.disptop;
+  if (disptopline < term_allrows && !(!down && term.disptop && !topline)
+      && !term.show_other_screen)
+    term_damage_move(disptopline, botline - term.disptop, down ? -lines : lines);
 
   // Reuse lines that are being scrolled out of the scroll region,
   // clearing their content.
@@ -2209,12 +3367,15 @@ term_do_scroll(int topline, int botline, int lines, bool sb)
         uchar *cline = scrollback_pop();
         termline *line = decompressline(cline, null);
         resizeline(line, term.cols);  // ensure sufficient line length
-        free(cline);
+        freecompressedline(cline);
         line->temporary = false;  /* reconstituted line is now real */
         freeline(term.lines[i]);
         term.lines[i] = line;
       }
     }
+    // restored lines renumber the whole screen
+    term_search_touch(term.sbseq == sbseq ? topline : 0, 
+                      term.sbseq == sbseq ? botline - 1 : term.rows - 1);
 
     // Move selection markers if they're within the scroll region
     void scroll_pos(pos *p) {
@@ -2243,7 +3404,7 @@ term_do_scroll(int topline, int botline, int lines, bool sb)
     // normal screen and scrollback is actually enabled.
     if (sb && topline == 0 && !term.on_alt_screen && cfg.scrollback_lines) {
       for (int i = 0; i < lines; i++)
-        scrollback_push(compressline(term.lines[i]), 0);
+        scrollback_push(compressline(term.lines[i]), term.lines[i], 0);
 
       // Shift viewpoint accordingly if user is looking at scrollback
       if (term.disptop < 0)
@@ -2257,6 +3418,14 @@ term_do_scroll(int topline, int botline, int lines, bool sb)
     memmove(top, top + lines, moved_lines * sizeof(termline *));
     memcpy(bot - lines, recycled, sizeof recycled);
 
+    // Lines pushed into the scrollback keep their absolute line numbers,
+    // so only the cleared lines and those below the region change
+    if (term.sbseq - sbseq == lines)
+      term_search_touch(botline - lines, term.rows - 1);
+    else
+      term_search_touch(topline, 
+                        term.sbseq == sbseq ? botline - 1 : term.rows - 1);
+
     // Move selection markers if they're within the scroll region
     void scroll_pos(pos *p) {
       if (!term.show_other_screen && p->y >= seltop && p->y < botline) {
@@ -2279,6 +3448,7 @@ clear_wrapcontd(termline * line, int y)
   if (y < term.rows - 1 && (line->lattr & LATTR_WRAPPED)) {
     line = term.lines[y + 1];
     line->lattr &= ~(LATTR_WRAPCONTD | LATTR_AUTOSEL);
+    touch_line(line);
   }
 }
 
@@ -2349,7 +3519,9 @@ term_erase(bool selective, bool line_only, bool from_begin, bool to_end)
       term.tempsblines = 0;
   }
   else {
+    term_search_touch(start.y, end.y);
     termline *line = term.lines[start.y];
+    touch_line(line);
     while (poslt(start, end)) {
       int cols = min(line->cols, line->size);
       if (start.x == cols) {
@@ -2368,8 +3540,10 @@ term_erase(bool selective, bool line_only, bool from_begin, bool to_end)
         if (!start.x)
           clear_cc(line, -1);
       }
-      if (inclpos(start, cols) && start.y < bot_y)
+      if (inclpos(start, cols) && start.y < bot_y) {
         line = term.lines[start.y];
+        touch_line(line);
+      }
     }
   }
 }
@@ -3020,8 +4194,48 @@ match_emoji(termchar * d, int maxlen)
   return emoji;
 }
 
+/*
+ * Render command list of the current frame: term_paint decides what 
+ * to draw and appends commands; the window backend executes them 
+ * (win_paint_cmds).
+ */
+static paint_cmd *
+paint_cmd_add(uchar type, int x, int y, int len, cattr attr, ushort lattr)
+{
+  termpaint * tp = &term.paint;
+  if (tp->len == tp->size) {
+    tp->size = tp->size ? tp->size * 2 : 256;
+    tp->cmds = renewn(tp->cmds, tp->size);
+  }
+  paint_cmd * pc = &tp->cmds[tp->len++];
+  *pc = (paint_cmd){
+    .type = type, .x = x, .y = y, .len = len, .attr = attr, .lattr = lattr
+  };
+  return pc;
+}
+
+static void
+paint_text(int x, int y, wchar *text, int len, cattr attr, cattr *textattr, ushort lattr, char has_rtl, char has_sea, bool clearpad, uchar phase)
+{
+  termpaint * tp = &term.paint;
+  if (tp->textlen + len > tp->textsize) {
+    tp->textsize = max(tp->textsize * 2, tp->textlen + len + 1024);
+    tp->text = renewn(tp->text, tp->textsize);
+    tp->textattr = renewn(tp->textattr, tp->textsize);
+  }
+  paint_cmd * pc = paint_cmd_add(PAINT_TEXT, x, y, len, attr, lattr);
+  pc->phase = phase;
+  pc->clearpad = clearpad;
+  pc->has_rtl = has_rtl;
+  pc->has_sea = has_sea;
+  pc->text = tp->textlen;
+  memcpy(tp->text + tp->textlen, text, len * sizeof(wchar));
+  memcpy(tp->textattr + tp->textlen, textattr, len * sizeof(cattr));
+  tp->textlen += len;
+}
+
 static void
-emoji_show(int x, int y, struct emoji e, int elen, cattr eattr, ushort lattr)
+paint_emoji(int x, int y, struct emoji e, int elen, cattr eattr, ushort lattr)
 {
   wchar * efn;
   void * * bufpoi;
@@ -3042,7 +4256,7 @@ emoji_show(int x, int y, struct emoji e, int elen, cattr eattr, ushort lattr)
     buflen = &emoji_bases[e.idx].buflen;
   }
 #if defined(debug_emojis) && debug_emojis > 1
-  printf("emoji_show @%d:%d..%d it %d seq %d idx %d <%ls>\n", y, x, elen, !!(eattr.attr & ATTR_ITALIC), e.seq, e.idx, efn);
+  printf("paint_emoji @%d:%d..%d it %d seq %d idx %d <%ls>\n", y, x, elen, !!(eattr.attr & ATTR_ITALIC), e.seq, e.idx, efn);
 #endif
 
   // Emoji overhang
@@ -3066,8 +4280,12 @@ emoji_show(int x, int y, struct emoji e, int elen, cattr eattr, ushort lattr)
       }
     }
 
-  if (efn && *efn)
-    win_emoji_show(x, y, efn, bufpoi, buflen, elen, lattr, eattr.attr & ATTR_ITALIC);
+  if (efn && *efn) {
+    paint_cmd * pc = paint_cmd_add(PAINT_EMOJI, x, y, elen, eattr, lattr);
+    pc->efn = efn;
+    pc->bufpoi = bufpoi;
+    pc->buflen = buflen;
+  }
 }
 
 #define dont_debug_win_text_invocation
@@ -3077,8 +4295,8 @@ emoji_show(int x, int y, struct emoji e, int elen, cattr eattr, ushort lattr)
 
 #ifdef debug_win_text_invocation
 
-void
-_win_text(int line, int tx, int ty, wchar *text, int len, cattr attr, cattr *textattr, ushort lattr, char has_rtl, char has_sea, bool clearpad, uchar phase)
+static void
+_paint_text(int line, int tx, int ty, wchar *text, int len, cattr attr, cattr *textattr, ushort lattr, char has_rtl, char has_sea, bool clearpad, uchar phase)
 {
   int last = len - 1;
   while (last >= 0 && text[last] == ' ')
@@ -3091,7 +4309,7 @@ _win_text(int line, int tx, int ty, wchar *text, int len, cattr attr, cattr *tex
     printf("\n");
   }
 
-  win_text(tx, ty, text, len, attr, textattr, lattr, has_rtl, has_sea, clearpad, phase);
+  paint_text(tx, ty, text, len, attr, textattr, lattr, has_rtl, has_sea, clearpad, phase);
 
 #ifdef debug_win_text_modified
   // debug modification by substitute_combining_chars feature, now disabled
@@ -3104,7 +4322,7 @@ _win_text(int line, int tx, int ty, wchar *text, int len, cattr attr, cattr *tex
 #endif
 }
 
-#define win_text(tx, ty, text, len, attr, textattr, lattr, has_rtl, has_sea, clearpad, phase) _win_text(__LINE__, tx, ty, text, len, attr, textattr, lattr, has_rtl, has_sea, clearpad, phase)
+#define paint_text(tx, ty, text, len, attr, textattr, lattr, has_rtl, has_sea, clearpad, phase) _paint_text(__LINE__, tx, ty, text, len, attr, textattr, lattr, has_rtl, has_sea, clearpad, phase)
 
 #endif
 
@@ -3156,23 +4374,248 @@ is_comcom(wchar ch)
   return false;
 }
 
+/*
+ * Display damage, accumulated per frame for the window layer 
+ * (see termdamage.c): scroll moves of the display contents, 
+ * cells exposed by the window (term_invalidate), modified since 
+ * they were painted, or painted by term_paint.
+ * The frame ends when the window layer has consumed the damage 
+ * and calls term_damage_clear.
+ */
+#define dont_debug_damage
+
+// the display row that term_paint painted the cursor on, or -1
+static int paint_curs_y = -1;
+
+static termdamage *
+damage(void)
+{
+  termdamage * dm = &term.damage;
+  if (dm->rows != term_allrows || dm->cols != term.cols)
+    damage_resize(dm, term_allrows, term.cols);
+  return dm;
+}
+
 void
-term_paint(void)
+term_damage(int top, int left, int bottom, int right)
 {
-  //if (kb_trace) printf("[%ld] term_paint\n", mtime());
+  damage_add(damage(), top, left, bottom, right);
+}
+
+void
+term_damage_move(int top, int bot, int lines)
+{
+  damage_move_add(damage(), top, bot, lines);
+}
+
+/*
+ * Check whether any cell of the given display area is damaged.
+ */
+bool
+term_damaged(int top, int left, int bottom, int right)
+{
+  return damage_test(damage(), top, left, bottom, right);
+}
 
-#ifdef use_display_scrolling
-  if (dispscroll_lines) {
-    disp_do_scroll(dispscroll_top, dispscroll_bot, dispscroll_lines);
-    dispscroll_lines = 0;
+void
+term_damage_clear(void)
+{
+#ifdef debug_damage
+  for (int k = 0; k < term.damage.moves_len; k++) {
+    damage_move * m = &term.damage.moves[k];
+    printf("damage move %d..%d by %d\n", m->top, m->bot - 1, m->lines);
+  }
+  for (int k = 0; k < term.damage.rects_len; k++) {
+    damage_rect * r = &term.damage.rects[k];
+    printf("damage %d:%d..%d:%d\n", r->top, r->left, r->bottom, r->right);
   }
 #endif
+  damage_clear(damage());
+}
+
+/*
+ * The window has moved its contents as described by the first 
+ * pending scroll move; move the display cache along.
+ */
+void
+term_display_moved(void)
+{
+  termdamage * dm = damage();
+  if (!dm->moves_len)
+    return;
+  damage_move * m = &dm->moves[0];
+  int topscroll = m->top, botscroll = m->bot;
+  bool down = m->lines < 0;
+  int lines = abs(m->lines);
+
+  termline * recycled[lines];
+  void recycle(int from) {
+    for (int l = 0; l < lines; l++) {
+      recycled[l] = term.displines[from + l];
+      clearline(recycled[l]);
+      recycled[l]->gen = 0;
+      for (int j = 0; j < term.cols; j++)
+        recycled[l]->chars[j].attr.attr |= ATTR_INVALID;
+    }
+  }
+  if (down) {
+    recycle(botscroll - lines);
+    memmove(term.displines + topscroll + lines, term.displines + topscroll,
+            (botscroll - topscroll - lines) * sizeof(termline *));
+    memcpy(term.displines + topscroll, recycled, sizeof recycled);
+  }
+  else {
+    recycle(topscroll);
+    memmove(term.displines + topscroll, term.displines + topscroll + lines,
+            (botscroll - topscroll - lines) * sizeof(termline *));
+    memcpy(term.displines + botscroll - lines, recycled, sizeof recycled);
+  }
+
+  // the cursor as painted moves along
+  if (paint_curs_y >= topscroll && paint_curs_y < botscroll) {
+    paint_curs_y += down ? lines : -lines;
+    if (paint_curs_y < topscroll || paint_curs_y >= botscroll)
+      paint_curs_y = -1;
+  }
+
+  damage_move_applied(dm);
+}
+
+/*
+ * Display state that term_paint applies on top of the line contents.
+ * While it is unchanged, rows whose line has not been modified since 
+ * it was painted (see touch_line) need not be checked again; 
+ * state that changes through the window (colours, fonts, configuration) 
+ * invalidates the display via term_invalidate instead.
+ */
+struct paint_context {
+  int disptop;
+  bool show_other_screen;
+  bool selected, sel_rect, selection_eq_clipboard;
+  pos sel_start, sel_end;
+  bool hovering;
+  int hoverlink;
+  pos hover_start, hover_end;
+  bool in_vbell;
+  int xquery_length, results_length;
+  long long int results_begin, results_end, sbseq;
+  result current;
+  bool markpos_valid;
+  int markpos;
+  bool has_focus, blink_is_real, enable_blink_colour, tblinker, tblinker2;
+  bool dim_margins;
+  int marg_top, marg_bot, marg_left, marg_right;
+};
+
+static void
+get_paint_context(struct paint_context * ctx)
+{
+  // clear padding too, for comparison with memcmp
+  memset(ctx, 0, sizeof(struct paint_context));
+  ctx->disptop = term.disptop;
+  ctx->show_other_screen = term.show_other_screen;
+  ctx->selected = term.selected;
+  if (term.selected) {
+    ctx->sel_rect = term.sel_rect;
+    ctx->selection_eq_clipboard = term.selection_eq_clipboard;
+    ctx->sel_start = term.sel_start;
+    ctx->sel_end = term.sel_end;
+  }
+  ctx->hovering = term.hovering;
+  if (term.hovering) {
+    ctx->hoverlink = term.hoverlink;
+    ctx->hover_start = term.hover_start;
+    ctx->hover_end = term.hover_end;
+  }
+  ctx->in_vbell = term.in_vbell;
+  ctx->xquery_length = term.results.xquery_length;
+  if (term.results.xquery_length) {
+    ctx->results_length = term.results.length;
+    ctx->results_begin = term.results.range_begin;
+    ctx->results_end = term.results.range_end;
+    ctx->current = term.results.current;
+    ctx->sbseq = term.sbseq;
+  }
+  ctx->markpos_valid = markpos_valid;
+  if (markpos_valid)
+    ctx->markpos = markpos;
+  ctx->has_focus = term.has_focus;
+  ctx->blink_is_real = term.blink_is_real;
+  ctx->enable_blink_colour = term.enable_blink_colour;
+  if (term.blink_is_real) {
+    ctx->tblinker = term.tblinker;
+    ctx->tblinker2 = term.tblinker2;
+  }
+  ctx->dim_margins = term.dim_margins;
+  if (term.dim_margins) {
+    ctx->marg_top = term.marg_top;
+    ctx->marg_bot = term.marg_bot;
+    ctx->marg_left = term.marg_left;
+    ctx->marg_right = term.marg_right;
+  }
+}
+
+void
+term_paint(void)
+{
+  //if (kb_trace) printf("[%ld] term_paint\n", mtime());
+
+  // lines not rewrapped yet may have been scrolled into view
+  if (rewrap_display())
+    win_set_timer(rewrap_cb, 1);
+
+  // start the render command list of this frame
+  term.paint.len = 0;
+  term.paint.textlen = 0;
+
+  // search the displayed lines for highlighting, or part of them
+  search_expand_display();
 
  /* The display line that the cursor is on, or -1 if the cursor is invisible. */
   int curs_y =
     term.cursor_on && !term.show_other_screen
     ? term.curs.y - term.disptop : -1;
 
+ /*
+  * Determine the rows to paint from the display damage: 
+  * add those whose line has been modified since it was painted, 
+  * those with the cursor on them before or now, 
+  * or all rows if the display context has changed.
+  * Scroll moves that the window has not applied are repainted.
+  */
+  static struct paint_context prev_ctx;
+  struct paint_context ctx;
+  get_paint_context(&ctx);
+  bool paint_all = memcmp(&ctx, &prev_ctx, sizeof ctx)
+                   // percentage is accumulated from all lines
+                   || (term.detect_progress && term.progress_scan == 2);
+  prev_ctx = ctx;
+
+  termdamage * dm = damage();
+  damage_drop_moves(dm);
+  bool paint_row[term_allrows];
+  ushort row_lattr[term_allrows];
+  for (int i = 0; i < term_allrows; i++) {
+    termline * line = fetch_line(i + term.disptop);
+    if (paint_all || i == curs_y || i == paint_curs_y
+        || line->gen != term.displines[i]->gen)
+      damage_add(dm, i, 0, i, term.cols - 1);
+    row_lattr[i] = line->lattr;
+    release_line(line);
+  }
+  for (int i = 0; i < term_allrows; i++)
+    paint_row[i] = damage_test(dm, i, 0, i, term.cols - 1);
+  paint_curs_y = curs_y;
+  // bidi direction of wrapped lines is determined by the whole paragraph
+  for (int i = 1; i < term_allrows; i++)
+    if (paint_row[i - 1] && (row_lattr[i] & LATTR_WRAPCONTD))
+      paint_row[i] = true;
+  for (int i = term_allrows - 1; i > 0; i--)
+    if (paint_row[i] && (row_lattr[i] & LATTR_WRAPCONTD))
+      paint_row[i - 1] = true;
+  // from here on, the damage notes what is painted (damage_run)
+  damage_clear(dm);
+
   int nlines_progress = 0;
   int total_progress = 0;
 
@@ -3181,6 +4624,10 @@ term_paint(void)
     pos scrpos;
     scrpos.y = i + term.disptop;
     termline *line = fetch_line(scrpos.y);
+    if (!paint_row[i]) {
+      release_line(line);
+      continue;
+    }
     // Prevent nested emoji sequence matching from matching partial subseqs
     int emoji_col = 0;  // column from which to match for emoji sequences
 
@@ -4060,11 +5507,11 @@ term_paint(void)
     }
     if (prevdirtyitalic) {
       // clear overhang into right padding border
-      win_text(term.cols, i, W(" "), 1, CATTR_DEFAULT, (cattr*)&CATTR_DEFAULT, line->lattr, false, false, true, 0);
+      paint_text(term.cols, i, W(" "), 1, CATTR_DEFAULT, (cattr*)&CATTR_DEFAULT, line->lattr, false, false, true, 0);
     }
     if (firstdirtyitalic) {
       // clear overhang into left padding border
-      win_text(-1, i, W(" "), 1, CATTR_DEFAULT, (cattr*)&CATTR_DEFAULT, line->lattr, false, false, true, 0);
+      paint_text(-1, i, W(" "), 1, CATTR_DEFAULT, (cattr*)&CATTR_DEFAULT, line->lattr, false, false, true, 0);
     }
 
 #define dont_debug_bidi_paragraphs
@@ -4083,14 +5530,14 @@ term_paint(void)
       diag += 'A' - '0' - 10;
     if (line->lattr & (LATTR_WRAPPED | LATTR_WRAPCONTD)) {
       if ((line->lattr & (LATTR_WRAPPED | LATTR_WRAPCONTD)) == (LATTR_WRAPPED | LATTR_WRAPCONTD))
-        win_text(-1, i, &diag, 1, CATTR_CONTWRAPD, (cattr*)&CATTR_CONTWRAPD, line->lattr, false, true, 0);
+        paint_text(-1, i, &diag, 1, CATTR_CONTWRAPD, (cattr*)&CATTR_CONTWRAPD, line->lattr, false, true, 0);
       else if (line->lattr & LATTR_WRAPPED)
-        win_text(-1, i, &diag, 1, CATTR_WRAPPED, (cattr*)&CATTR_WRAPPED, line->lattr, false, true, 0);
+        paint_text(-1, i, &diag, 1, CATTR_WRAPPED, (cattr*)&CATTR_WRAPPED, line->lattr, false, true, 0);
       else
-        win_text(-1, i, &diag, 1, CATTR_CONTD, (cattr*)&CATTR_CONTD, line->lattr, false, true, 0);
+        paint_text(-1, i, &diag, 1, CATTR_CONTD, (cattr*)&CATTR_CONTD, line->lattr, false, true, 0);
     }
     else if (displine->lattr & (LATTR_WRAPPED | LATTR_WRAPCONTD))
-      win_text(-1, i, W(" "), 1, CATTR_DEFAULT, (cattr*)&CATTR_DEFAULT, line->lattr, false, true, 0);
+      paint_text(-1, i, W(" "), 1, CATTR_DEFAULT, (cattr*)&CATTR_DEFAULT, line->lattr, false, true, 0);
 #endif
 
    /*
@@ -4137,7 +5584,7 @@ term_paint(void)
     {
       if (ovl_len) {
         // now flush the text for 2-phase output
-        win_text(ovl_x, ovl_y, ovl_text, ovl_len, ovl_attr, ovl_textattr, ovl_lattr, ovl_has_rtl, ovl_has_sea, false, 2);
+        paint_text(ovl_x, ovl_y, ovl_text, ovl_len, ovl_attr, ovl_textattr, ovl_lattr, ovl_has_rtl, ovl_has_sea, false, 2);
         ovl_len = 0;
       }
     }
@@ -4206,7 +5653,7 @@ term_paint(void)
             if (elen == 1 && attr.attr & TATTR_OVERHANG)
               elen = 2;
             // fill emoji background
-            win_text(x, y, esp, elen, eattr, textattr, lattr, has_rtl, has_sea, false, 1);
+            paint_text(x, y, esp, elen, eattr, textattr, lattr, has_rtl, has_sea, false, 1);
             flush_text();
           }
 #if defined(debug_emojis) && debug_emojis > 4
@@ -4214,14 +5661,14 @@ term_paint(void)
           eattr.attr &= ~(ATTR_BGMASK | ATTR_FGMASK);
           eattr.attr |= 6 << ATTR_BGSHIFT | 4;
           esp[0] = '0' + elen;
-          win_text(x, y, esp, elen, eattr, textattr, lattr, has_rtl, has_sea, false, 2);
+          paint_text(x, y, esp, elen, eattr, textattr, lattr, has_rtl, has_sea, false, 2);
 #endif
           if (cfg.emoji_placement == EMPL_FULL && !overlaying)
             do_overlay = true;  // display in overlaying loop
           else {
             //struct emoji e = (struct emoji) eattr.truefg;
             struct emoji * ee = (void *)&eattr.truefg;
-            emoji_show(x, y, *ee, elen, eattr, lattr);
+            paint_emoji(x, y, *ee, elen, eattr, lattr);
           }
         }
 #if defined(debug_emojis) && debug_emojis > 4
@@ -4229,7 +5676,7 @@ term_paint(void)
           eattr.attr &= ~(ATTR_BGMASK | ATTR_FGMASK);
           eattr.attr |= 4 << ATTR_BGSHIFT | 6;
           esp[0] = '0';
-          win_text(x, y, esp, 1, eattr, textattr, lattr, has_rtl, has_sea, false, 2);
+          paint_text(x, y, esp, 1, eattr, textattr, lattr, has_rtl, has_sea, false, 2);
         }
 #endif
       }
@@ -4257,7 +5704,7 @@ term_paint(void)
          */
 #ifndef phase1_output_after_phase2_copy
         // phase 1 output for the background
-        win_text(x, y, text, len, attr, textattr, lattr, has_rtl, has_sea, false, 1);
+        paint_text(x, y, text, len, attr, textattr, lattr, has_rtl, has_sea, false, 1);
         flush_text();
 #endif
 
@@ -4279,16 +5726,25 @@ term_paint(void)
         // phase 1 output for the background
         // - it used to cause overhang clipping (#1304, #1311)
         // when this was done after phase 2 output copy above
-        win_text(x, y, text, len, attr, textattr, lattr, has_rtl, has_sea, false, 1);
+        paint_text(x, y, text, len, attr, textattr, lattr, has_rtl, has_sea, false, 1);
         flush_text();
 #endif
       }
       else {
-        win_text(x, y, text, len, attr, textattr, lattr, has_rtl, has_sea, false, 0);
+        paint_text(x, y, text, len, attr, textattr, lattr, has_rtl, has_sea, false, 0);
         flush_text();
       }
     }
 
+    // note the cells of a painted run in the display damage
+    void damage_run(int x0, int x1)
+    {
+      if ((line->lattr & LATTR_MODE) == LATTR_NORM)
+        term_damage(i, x0, i, x1);
+      else
+        term_damage(i, x0 * 2, i, x1 * 2 + 1);
+    }
+
     //trace_line("loop3", newchars);
 
    /*
@@ -4430,6 +5886,8 @@ term_paint(void)
       if (break_run || cfg.bloom) {
         if ((dirty_run && textlen) || overlaying)
           out_text(start, i, text, textlen, attr, textattr, line->lattr, has_rtl, has_sea);
+        if (dirty_run && textlen && !overlaying)
+          damage_run(start, j - 1);
         start = j;
         textlen = 0;
         has_rtl = 0;
@@ -4582,8 +6040,11 @@ term_paint(void)
 #endif
       }
     }
-    if (dirty_run && textlen)
+    if (dirty_run && textlen) {
       out_text(start, i, text, textlen, attr, textattr, line->lattr, has_rtl, has_sea);
+      if (!overlaying)
+        damage_run(start, term.cols - 1);
+    }
     if (!overlaying)
       flush_text();
 
@@ -4595,6 +6056,9 @@ term_paint(void)
       goto overlay;
     }
 
+    // note the line version now displayed in this row
+    displine->gen = line->gen;
+
    /*
     * Release the line data fetched from the screen or scrollback buffer.
     */
@@ -4620,6 +6084,8 @@ term_invalidate(int left, int top, int right, int bottom)
   if (bottom >= term_allrows)
     bottom = term_allrows - 1;
 
+  term_damage(top, left, bottom, right);
+
   for (int i = top; i <= bottom && i < term_allrows; i++) {
     if ((term.displines[i]->lattr & LATTR_MODE) == LATTR_NORM)
       for (int j = left; j <= right && j < term.cols; j++)
@@ -4650,6 +6116,7 @@ term_scroll(int rel, int where)
   int sbtop = -sblines();
   int sbbot = term_last_nonempty_line();
   bool do_schedule_update = false;
+  int olddisptop = term.disptop;
 
   if (rel == SB_PRIOR || rel == SB_NEXT) {
     if (!markpos_valid) {
@@ -4676,6 +6143,7 @@ term_scroll(int rel, int where)
     term.disptop = sbtop;
   if (term.disptop > 0)
     term.disptop = 0;
+  term_damage_move(0, term.rows, term.disptop - olddisptop);
   win_update(false);
 
   if (do_schedule_update) {
@@ -3,6 +3,7 @@
 
 #include "minibidi.h"
 #include "config.h"
+#include "termdamage.h"
 
 // Colour numbers
 
@@ -273,7 +274,11 @@ typedef struct {
   ushort size;    /* number of allocated termchars
                      (cc-lists may make this > cols) */
   bool temporary; /* true if decompressed from scrollback */
+  ushort refs;    /* fetch_line references to a cached scrollback line */
   short cc_free;  /* offset to first cc in free list */
+  long long int gen;  /* modification generation (see touch_line);
+                         for display lines: that of the line painted */
+  bool has_bidi;  /* may contain characters for bidi or shaping (mark_bidi) */
   termchar *chars;
 } termline;
 
@@ -287,12 +292,17 @@ extern void resizeline(termline *, int);
 extern int sblines(void);
 extern termline *fetch_line(int y);
 extern void release_line(termline *);
+extern int term_para_first(int y);
+extern int term_para_last(int y);
 
 
 /* Terminal state */
 typedef struct {
   int width;
   ushort lattr;
+  unsigned long long hash;      /* of chars, see termchars_hash */
+  termline *line;               /* line and generation the chars were */
+  long long int gen;            /* last found equal to (no reference) */
   termchar *chars;
   int *forward, *backward;      /* the permutations of line positions */
 } bidi_cache_entry;
@@ -348,11 +358,13 @@ typedef enum {
 
 /* Searching */
 typedef struct {
-  // Index of a virtual array of scrollback + screen.
-  // y = idx / term.cols
-  // x = idx % term.rows
-  // y starts from the top most line (y = 0, the first line of scrollback or screen).
-  int idx;
+  // Absolute cell position in scrollback + screen:
+  // y = idx / term.cols is the absolute line number (see term.sbseq),
+  // so the first line of the screen is y = term.sbseq, and the top most 
+  // line of the scrollback is y = term.sbseq - term.sblines;
+  // x = idx % term.cols.
+  // Positions stay valid while lines scroll into and out of the scrollback.
+  long long int idx;
   // The length of a match, maybe larger than term.results.xquery_length because of UCSWIDE.
   int len;
 } result;
@@ -361,7 +373,7 @@ typedef struct {
   // The current active result, for prev/next button.
   result current;
   // An idx can be matched against term.results.results iff idx in [range_begin, range_end).
-  int range_begin, range_end;
+  long long int range_begin, range_end;
   result * results;
   wchar * query;
   xchar * xquery;
@@ -370,6 +382,17 @@ typedef struct {
   int capacity;
   int length;
   int update_type;
+  // Absolute lines [dirty_begin, dirty_end) changed since the last update,
+  // to be searched again by a partial update
+  long long int dirty_begin, dirty_end;
+  // Number of matches in scrollback + screen, counted in time slices;
+  // matches before count_pos have been counted.
+  int count;
+  long long int count_pos;
+  bool counting;
+  // Regular expression mode; rx is null if the query is not a valid pattern
+  bool regex_mode;
+  struct regex * rx;
 } termresults;
 
 
@@ -434,6 +457,42 @@ typedef struct {
 } termimgs;
 
 
+/* Render commands, produced by term_paint for the window backend */
+typedef enum {
+  PAINT_TEXT,   // text run, to be drawn like win_text
+  PAINT_EMOJI,  // emoji graphics, to be drawn like win_emoji_show
+} paint_cmd_type;
+
+typedef struct {
+  uchar type;
+  uchar phase;        // text: output phase (background, foreground, both)
+  bool clearpad;      // text: clear padding border next to the cell
+  char has_rtl, has_sea;
+  ushort lattr;
+  short x, y;         // display cell; x may be -1 or term.cols for padding
+  int len;            // text: number of characters; emoji: number of cells
+  cattr attr;         // resolved attributes, including cursor indication
+  union {
+    // text: characters and their attributes in termpaint.text/textattr
+    int text;
+    // emoji: image file and image cache
+    struct {
+      wchar * efn;
+      void * * bufpoi;
+      int * buflen;
+    };
+  };
+} paint_cmd;
+
+typedef struct {
+  paint_cmd * cmds;
+  int len, size;
+  wchar * text;
+  cattr * textattr;
+  int textlen, textsize;
+} termpaint;
+
+
 enum {
   MODO_1 = 1,
   MODO_2 = 2,
@@ -480,18 +539,29 @@ struct term {
   term_cursor curs;              /* cursor */
   term_cursor saved_cursors[2];  /* saved cursor of normal/alternate screen */
 
-  uchar **scrollback;     /* lines scrolled off top of screen */
-  int sbsize;             /* buffer size of scrollback buffer */
+  uchar ***scrollback;    /* lines scrolled off top of screen,
+                           * in chunks of SBCHUNK lines */
+  int sbchunks;           /* number of allocated chunks */
   int disptop;            /* distance scrolled back (0 or -ve) */
   int sblines;            /* number of lines of scrollback */
-  int sbpos;              /* index of next scrollback position to be filled */
+  int sbfirst;            /* index of oldest line within first chunk */
   int tempsblines;        /* number of lines of .scrollback that
                            * can be retrieved onto the terminal
                            * ("temporary scrollback") */
+  int sbpending;          /* number of oldest lines of .scrollback that
+                           * have not been rewrapped to the current width
+                           * (see term_rewrap_pending) */
+  long long int sbseq;    /* absolute number of the next line to be
+                           * pushed into scrollback */
+  long long int sbbytes;  /* memory used by compressed scrollback lines */
+  long long int sbcells;  /* number of cells stored in scrollback lines */
   long long int virtuallines;
   long long int altvirtuallines;
 
   termlines *displines;   /* buffer of text on real screen */
+  long long int linegen;  /* last line modification generation */
+  termdamage damage;      /* display damage of the current frame */
+  termpaint paint;        /* render commands of the current frame */
 
   termchar erase_char;
 
@@ -681,8 +751,10 @@ struct term {
   int sel_scroll;
   pos sel_pos;
 
-  wchar *paste_buffer;
+  wchar *paste_buffer;    /* clipboard text being pasted */
   int paste_len, paste_pos;
+  bool paste_all;         /* don't filter (FilterPasteControls) */
+  bool paste_bracketed, paste_split;
 
  /* True when we've seen part of a multibyte input char */
   bool in_mb_char;
@@ -708,12 +780,23 @@ struct term {
 
 extern struct term term;
 
+/*
+ * Stamp a line with a new modification generation, so that term_paint 
+ * repaints it; to be applied whenever the contents or line attributes 
+ * of a line are changed.
+ */
+#define touch_line(line)	((line)->gen = ++term.linegen)
+// flag a line that needs bidi processing for character c (term_bidi_line)
+#define mark_bidi(line, c)	\
+  ((line)->has_bidi |= (c) >= 0x0590 && is_bidi_class(bidi_class(c)))
+
 extern void scroll_rect(int topline, int botline, int lines);
 
 extern void term_resize(int rows, int cols, bool quick_reflow);
 extern void term_scroll(int relative_to, int where);
 extern void term_reset(bool full);
 extern void term_clear_scrollback(void);
+extern void term_rewrap_pending(void);
 extern bool term_mouse_click(mouse_button, mod_keys, pos, int count);
 extern void term_mouse_release(mouse_button, mod_keys, pos);
 extern void term_mouse_move(mod_keys, pos);
@@ -721,6 +804,11 @@ extern void term_mouse_wheel(bool horizontal, int delta, int lines_per_notch, mo
 extern void term_select_all(void);
 extern void term_paint(void);
 extern void term_invalidate(int left, int top, int right, int bottom);
+extern void term_damage(int top, int left, int bottom, int right);
+extern void term_damage_move(int top, int bot, int lines);
+extern bool term_damaged(int top, int left, int bottom, int right);
+extern void term_damage_clear(void);
+extern void term_display_moved(void);
 extern void term_open(void);
 extern void term_copy(void);
 extern void term_copy_as(char what);
@@ -739,11 +827,12 @@ extern void term_hide_cursor(void);
 
 extern void term_set_search(wchar * needle);
 extern void term_schedule_search_partial_update(void);
+extern void term_search_touch(int y0, int y1);
 extern void term_schedule_search_update(void);
 extern void term_update_search(void);
 extern void term_clear_results(void);
 extern void term_clear_search(void);
-extern void term_search_expand(int idx);
+extern void term_search_expand(long long int idx);
 extern result term_search_prev(void);
 extern result term_search_next(void);
 
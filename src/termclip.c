@@ -6,6 +6,7 @@
 #include "termpriv.h"
 
 #include "win.h"
+#include "winpriv.h"  // win_prefix_title, PADDING
 #include "child.h"
 #include "charset.h"
 
@@ -17,6 +18,8 @@ typedef struct {
   // the attributes part of the buffer is only filled as requested
   bool with_attrs;
   cattr * cattrs;  // matching cattr for each wchar of text
+  // number of trailing blanks filling an expanded TAB (see clip_addchar)
+  size_t tabfill;
 } clip_workbuf;
 
 static void
@@ -31,95 +34,105 @@ destroy_clip_workbuf(clip_workbuf * b, bool with_text)
   free(b);
 }
 
-// All b members must be 0 initially, ca may be null if the caller doesn't care
-static void
-clip_addchar(clip_workbuf * b, wchar chr, cattr * ca, bool tabs, ulong sizehint)
+// Ensure space for n items; returns false if out of memory
+static bool
+clip_reserve(clip_workbuf * b, size_t n)
 {
-  // ensure sizehint > 0
-  sizehint = max(sizehint, 8);
-
-  if (tabs && chr == ' ' && ca && ca->attr & TATTR_CLEAR && ca->attr & ATTR_BOLD) {
-    // collapse TAB
-    int l0 = b->len;
-    while (l0) {
-      l0--;
-      if (b->text[l0] == ' ' && b->cattrs[l0].attr & TATTR_CLEAR && b->cattrs[l0].attr & ATTR_DIM)
-        b->len--;
-      else
-        break;
-    }
-    chr = '\t';
-  }
-
-  bool err = false;
-
-  if (b->len >= b->capacity) {
-    //b->capacity = b->len ? b->len * 2 : 1024;  // x2 strategy, 1K chars initially
-    //b->capacity += sizehint;
-    //b->capacity = b->capacity ? b->capacity * 3 / 2 : sizehint;
-    b->capacity = b->capacity ? b->capacity * 5 / 4 : sizehint;
+  if (n <= b->capacity)
+    return true;
 
-    wchar * _text = renewn(b->text, b->capacity);
-    if (_text)
-      b->text = _text;
-    else
-      err = true;
-    if (b->with_attrs) {
-      // the attributes part of the buffer is only filled as requested
-      cattr * _cattrs = renewn(b->cattrs, b->capacity);
-      if (_cattrs)
-        b->cattrs = _cattrs;
-      else
-        err = true;
-    }
-  }
-  if (err) {
-    //printf("buf alloc err\n");
-    return;
+  // grow by at least 5/4, for the rare lines beyond the size estimate
+  size_t capacity = max(n, b->capacity * 5 / 4);
+  wchar * _text = renewn(b->text, capacity);
+  if (!_text)
+    return false;
+  b->text = _text;
+  if (b->with_attrs) {
+    // the attributes part of the buffer is only filled as requested
+    cattr * _cattrs = renewn(b->cattrs, capacity);
+    if (!_cattrs)
+      return false;
+    b->cattrs = _cattrs;
   }
+  b->capacity = capacity;
+  return true;
+}
 
-  cattr copattr = ca ? *ca : CATTR_DEFAULT;
-  //printf("setting clipbuf[%ld] = %02X\n", b->len, chr);
-  if (copattr.attr & TATTR_CLEAR) {
-    if (!tabs)
-      copattr.attr &= ~(ATTR_BOLD | ATTR_DIM | TATTR_CLEAR);
+// Append a character to reserved space, ca may be null if the caller doesn't care
+static inline void
+clip_addchar(clip_workbuf * b, wchar chr, cattr * ca, bool tabs)
+{
+  if (tabs && chr == ' ' && ca && ca->attr & TATTR_CLEAR) {
+    if (ca->attr & ATTR_BOLD) {
+      // collapse TAB, dropping the blanks it was filled with
+      b->len -= b->tabfill;
+      b->tabfill = 0;
+      chr = '\t';
+    }
+    else if (ca->attr & ATTR_DIM)
+      b->tabfill++;
+    else
+      b->tabfill = 0;
   }
+  else
+    b->tabfill = 0;
 
   b->text[b->len] = chr;
-  if (b->with_attrs)
+  if (b->with_attrs) {
     // the attributes part of the buffer is only filled as requested
+    cattr copattr = ca ? *ca : CATTR_DEFAULT;
+    if (copattr.attr & TATTR_CLEAR) {
+      if (!tabs)
+        copattr.attr &= ~(ATTR_BOLD | ATTR_DIM | TATTR_CLEAR);
+    }
     b->cattrs[b->len] = copattr;
+  }
 
   b->len++;
 }
 
+/*
+   Streaming exports pass a sink to get_selection, which then hands over 
+   the buffer at the end of a line whenever it has collected CLIP_CHUNK 
+   characters, and empties it, so the buffer does not grow with the size 
+   of the exported area. The final chunk includes the terminating NUL.
+ */
+#define CLIP_CHUNK 0x10000
+
 // except OOM, guaranteed at least emtpy null terminated wstring and one cattr
 static clip_workbuf *
-get_selection(bool attrs, pos start, pos end, bool rect, bool allinline, bool with_tabs)
+get_selection(bool attrs, pos start, pos end, bool rect, bool allinline, bool with_tabs, void (*sink)(clip_workbuf *))
 {
   //printf("get_selection attrs %d all %d tabs %d\n", attrs, allinline, with_tabs);
 
-  if (with_tabs)
-    attrs = true;  // ensure we can check expanded TABs (#1269)
   clip_workbuf *buf = newn(clip_workbuf, 1);
   *buf = (clip_workbuf){.with_attrs = attrs,
                         .capacity = 0, .len = 0, .text = 0, .cattrs = 0};
 
-  // estimate buffer size needed, to give memory allocation increments a hint
+  // allocate the buffer once: every cell yields at most one character, 
+  // and every line a CR/LF, except for combining characters, 
+  // which are provided for line by line
   int lines = end.y - start.y;
-  long hint = (long)lines * term.cols / 8;
   //printf("get_selection %d...%d (%d)\n", start.y, end.y, lines);
-  // check overflow
-  if (lines < 0 || hint < 0) {
+  if (lines < 0) {
     //printf("buf start > end %d\n", lines);
     return buf;
   }
+  size_t size = (size_t)(lines + 1) * (term.cols + 2) + 1;
+  if (sink)
+    size = min(size, CLIP_CHUNK + term.cols + 3);
+  if (!clip_reserve(buf, size))
+    return buf;
 
   int old_top_x = start.x;    /* needed for rect==1 */
 
   while (poslt(start, end)) {
     bool nl = false;
     termline *line = fetch_line(start.y);
+    if (!clip_reserve(buf, buf->len + line->size + 3)) {
+      release_line(line);
+      break;
+    }
 
     if (allinline) {
       // this tweak (commit 975403 "export HTML: consider cursor", 2.9.1)
@@ -127,6 +140,7 @@ get_selection(bool attrs, pos start, pos end, bool rect, bool allinline, bool wi
       // now guarded to cases of HTML copy/export
       if (start.y == term.curs.y) {
         line->chars[term.curs.x].attr.attr |= TATTR_ACTCURS;
+        touch_line(line);
       }
     }
 
@@ -187,7 +201,6 @@ get_selection(bool attrs, pos start, pos end, bool rect, bool allinline, bool wi
     }
 
     while (poslt(start, end) && poslt(start, nlpos)) {
-      wchar cbuf[16], *p;
       int x = start.x;
 
       if (line->chars[x].chr == UCSWIDE) {
@@ -206,11 +219,9 @@ get_selection(bool attrs, pos start, pos end, bool rect, bool allinline, bool wi
         }
         else
           sixel_clipp = (wchar *)cfg.sixel_clip_char;
-        cbuf[0] = c;
-        cbuf[1] = 0;
 
-        for (p = cbuf; *p; p++)
-          clip_addchar(buf, *p, pca, with_tabs, hint);
+        if (c)
+          clip_addchar(buf, c, pca, with_tabs);
 
         if (line->chars[x].cc_next)
           x += line->chars[x].cc_next;
@@ -224,18 +235,27 @@ get_selection(bool attrs, pos start, pos end, bool rect, bool allinline, bool wi
       nl = false;
     }
     if (nl) {
-      clip_addchar(buf, '\r', 0, false, hint);
+      clip_addchar(buf, '\r', 0, false);
       // mark lineend with line attributes, particularly double-width/height
       cattr lcattr = CATTR_DEFAULT;
       lcattr.link = line->lattr;
-      clip_addchar(buf, '\n', &lcattr, false, hint);
+      clip_addchar(buf, '\n', &lcattr, false);
+      if (sink && buf->len >= CLIP_CHUNK) {
+        sink(buf);
+        buf->len = 0;
+      }
     }
     start.y++;
     start.x = rect ? old_top_x : 0;
 
     release_line(line);
   }
-  clip_addchar(buf, 0, 0, false, hint);
+  if (clip_reserve(buf, buf->len + 1))
+    clip_addchar(buf, 0, 0, false);
+  if (sink) {
+    sink(buf);
+    buf->len = 0;
+  }
   //printf("get_selection done\n");
   return buf;
 }
@@ -243,7 +263,7 @@ get_selection(bool attrs, pos start, pos end, bool rect, bool allinline, bool wi
 static wchar *
 get_sel_str(pos start, pos end, bool rect, bool allinline, bool with_tabs)
 {
-  clip_workbuf * buf = get_selection(false, start, end, rect, allinline, with_tabs);
+  clip_workbuf * buf = get_selection(false, start, end, rect, allinline, with_tabs, 0);
   wchar * selstr = buf->text;
   destroy_clip_workbuf(buf, false);
   return selstr;
@@ -259,7 +279,7 @@ term_copy_as(char what)
   if (what == 'T' || what == 'p') // map "text with TABs" and "plain" to text
     what = 't';
   clip_workbuf *buf = get_selection(true, term.sel_start, term.sel_end, term.sel_rect,
-                                    false, with_tabs);
+                                    false, with_tabs, 0);
   // for CopyAsHTML, get_selection will be called another time
   // but with different parameters
   win_copy_as(buf->text, buf->cattrs, buf->len, what);
@@ -389,54 +409,47 @@ term_paste(wchar *data, uint len, bool all)
 
   term_cancel_paste();
 
-  uint size = len;
+  // Keep the clipboard contents, to be converted chunk by chunk
+  // as the child process takes them (see term_send_paste)
   term.paste_buffer = newn(wchar, len);
-  term.paste_len = term.paste_pos = 0;
-
-  bool bracketed_paste_split_by_line = term.bracketed_paste 
+  if (!term.paste_buffer)
+    return;
+  memcpy(term.paste_buffer, data, len * sizeof(wchar));
+  term.paste_len = len;
+  term.paste_pos = 0;
+  term.paste_all = all;
+  term.paste_bracketed = term.bracketed_paste;
+  term.paste_split = term.bracketed_paste 
        && cfg.bracketed_paste_split
        && (cfg.bracketed_paste_split > 1 || !term.on_alt_screen);
 
-  // Copy data to the paste buffer, converting both Windows-style \r\n and
-  // Unix-style \n line endings to \r, because that's what the Enter key sends.
-  for (uint i = 0; i < len; i++) {
-    // swallow closing paste bracket if included in clipboard contents,
-    // in order to prevent (malicious) premature end of bracketing
-    if (term.bracketed_paste) {
-      if (i + 6 <= len && wcsncmp(W("\e[201~"), &data[i], 6) == 0) {
-        i += 6 - 1;
-        continue;
-      }
-    }
-
-    wchar wc = data[i];
-    if (wc == '\n')
-      wc = '\r';
-    if (!all && *cfg.filter_paste && isin_filter(wc))
-      wc = ' ';
+  if (term.paste_bracketed)
+    child_write("\e[200~", 6);
+  term_send_paste();
+}
 
-    if (data[i] != '\n')
-      term.paste_buffer[term.paste_len++] = wc;
-    else if (i == 0 || data[i - 1] != '\r')
-      term.paste_buffer[term.paste_len++] = wc;
-    else
-      continue;
+/*
+   Progress of a large paste is shown as a title prefix.
+ */
+#define PASTE_PROGRESS 100000
+static wchar paste_title[20];
 
-    // split bracket embedding by line
-    if (bracketed_paste_split_by_line && wc == '\r' && i + 1 < len
-     && (i + 2 != len || 0 != wcsncmp(&data[i], W("\r\n"), 2))
-       )
-    {
-      size += 12;
-      term.paste_buffer = renewn(term.paste_buffer, size);
-      wcsncpy(&term.paste_buffer[term.paste_len], W("\e[201~\e[200~"), 12);
-      term.paste_len += 12;
-    }
+static void
+paste_progress(void)
+{
+  wchar title[lengthof(paste_title)];
+  if (term.paste_buffer && term.paste_len >= PASTE_PROGRESS)
+    swprintf(title, lengthof(title), W("[Pasting %d%%] "),
+             (int)(term.paste_pos * 100LL / term.paste_len));
+  else
+    *title = 0;
+  if (wcscmp(title, paste_title)) {
+    if (*paste_title)
+      win_unprefix_title(paste_title);
+    wcscpy(paste_title, title);
+    if (*paste_title)
+      win_prefix_title(paste_title);
   }
-
-  if (term.bracketed_paste)
-    child_write("\e[200~", 6);
-  term_send_paste();
 }
 
 void
@@ -445,7 +458,8 @@ term_cancel_paste(void)
   if (term.paste_buffer) {
     free(term.paste_buffer);
     term.paste_buffer = 0;
-    if (term.bracketed_paste)
+    paste_progress();
+    if (term.paste_bracketed)
       child_write("\e[201~", 6);
   }
 }
@@ -453,31 +467,61 @@ term_cancel_paste(void)
 void
 term_send_paste(void)
 {
-  int i = term.paste_pos;
   /* We must not feed more than MAXPASTEMAX bytes into the pty in one chunk 
      or it will block on the receiving side (write() does not return).
    */
 #define MAXPASTEMAX 7819
 #define PASTEMAX 2222
-  while (i < term.paste_len && i - term.paste_pos < PASTEMAX
-         && term.paste_buffer[i++] != '\r'
-        )
-    ;
-  if (i < term.paste_len && is_high_surrogate(term.paste_buffer[i]))
-    i++;
-  //printf("term_send_paste pos %d @ %d (len %d)\n", term.paste_pos, i, term.paste_len);
-  child_sendw(term.paste_buffer + term.paste_pos, i - term.paste_pos);
-  if (i < term.paste_len) {
-    term.paste_pos = i;
-    // if only part of the paste buffer has been written to the child,
-    // the current strategy is to leave the rest pending for on-demand 
-    // invocation of term_send_paste from child_proc within the main loop,
-    // however, that causes partial loss of large paste contents;
-    // worse, without the PASTEMAX limitation, if long contents without 
-    // lineends is pasted, the terminal stalls (#810);
-    // attempts to replace the pending strategy with looping here (to 
-    // paste the whole contents) were not successful to solve the stalling
+  wchar * data = term.paste_buffer;
+  int len = term.paste_len;
+  int i = term.paste_pos;
+  wchar chunk[PASTEMAX + 1 + 12];
+  int n = 0;
+
+  // Convert up to the next line end, at most PASTEMAX characters,
+  // converting both Windows-style \r\n and Unix-style \n line endings 
+  // to \r, because that's what the Enter key sends.
+  while (i < len && (n < PASTEMAX || is_high_surrogate(chunk[n - 1]))) {
+    // swallow closing paste bracket if included in clipboard contents,
+    // in order to prevent (malicious) premature end of bracketing
+    if (term.paste_bracketed) {
+      if (i + 6 <= len && wcsncmp(W("\e[201~"), &data[i], 6) == 0) {
+        i += 6;
+        continue;
+      }
+    }
+
+    wchar wc = data[i++];
+    if (wc == '\n') {
+      if (i > 1 && data[i - 2] == '\r')
+        continue;
+      wc = '\r';
+    }
+    if (!term.paste_all && *cfg.filter_paste && isin_filter(wc))
+      wc = ' ';
+    chunk[n++] = wc;
+
+    if (wc == '\r') {
+      // split bracket embedding by line
+      if (term.paste_split && i < len
+       && (i + 1 != len || 0 != wcsncmp(&data[i - 1], W("\r\n"), 2))
+         )
+      {
+        wcsncpy(&chunk[n], W("\e[201~\e[200~"), 12);
+        n += 12;
+      }
+      break;
+    }
   }
+
+  //printf("term_send_paste pos %d @ %d (len %d)\n", term.paste_pos, i, term.paste_len);
+  term.paste_pos = i;
+  if (n)
+    child_sendw(chunk, n);
+  // the rest is left pending for invocation of term_send_paste 
+  // from child_proc whenever the pty can take more input
+  if (i < len)
+    paste_progress();
   else
     term_cancel_paste();
 }
@@ -485,6 +529,7 @@ term_send_paste(void)
 void
 term_select_all(void)
 {
+  term_rewrap_pending();
   term.sel_start = (pos){-sblines(), 0, 0, 0, false};
   term.sel_end = (pos){term_last_nonempty_line(), term.cols, 0, 0, true};
   term.selected = true;
@@ -502,6 +547,9 @@ term_get_text(bool all, bool screen, bool command)
   pos end;
   bool rect = false;
 
+  if (all || command)
+    term_rewrap_pending();
+
   if (command) {
     int sbtop = -sblines();
     int y = term_last_nonempty_line();
@@ -653,7 +701,6 @@ term_cmd(char * cmd)
 #include <time.h>
 #include <sys/time.h>
 #include <fcntl.h>
-#include "winpriv.h"  // PADDING
 
 static char *
 term_create_html(bool all, FILE * hf, int level)
@@ -664,23 +711,26 @@ term_create_html(bool all, FILE * hf, int level)
   void
   hprintf(FILE * hf, const char * fmt, ...)
   {
-    char * buf;
     va_list va;
     va_start(va, fmt);
+    if (hf) {
+      // write through, without an intermediate copy
+      vfprintf(hf, fmt, va);
+      va_end(va);
+      return;
+    }
+    char * buf;
     int len = vasprintf(&buf, fmt, va);
     va_end(va);
-    if (hf)
-      fprintf(hf, "%s", buf);
-    else {
-      if (hbuf_len + len > hbuf_cap) {
+    if (hbuf_len + len > hbuf_cap) {
+      while (hbuf_len + len > hbuf_cap)
         hbuf_cap = hbuf_cap ? hbuf_cap * 5 / 4 : 5555;
-        hbuf = renewn(hbuf, hbuf_cap + 1);
-      }
-
-      //strcat(hbuf, buf);
-      strcpy(hbuf + hbuf_len, buf);
-      hbuf_len += len;
+      hbuf = renewn(hbuf, hbuf_cap + 1);
     }
+
+    //strcat(hbuf, buf);
+    strcpy(hbuf + hbuf_len, buf);
+    hbuf_len += len;
     free(buf);
   }
 
@@ -694,6 +744,7 @@ term_create_html(bool all, FILE * hf, int level)
   }
   if (all) {
     // mark all, like term_select_all() without term_copy()
+    term_rewrap_pending();
     start = (pos){-sblines(), 0, 0, 0, false};
     end = (pos){term_last_nonempty_line(), term.cols, 0, 0, true};
     rect = false;
@@ -897,370 +948,517 @@ term_create_html(bool all, FILE * hf, int level)
   hprintf(hf, "  <div class=background id='vt100'>\n");
   hprintf(hf, "   <pre\n>");
 
-  clip_workbuf * buf = get_selection(true, start, end, rect, level >= 3, false);
-  int i0 = 0;
-  bool odd = true;
-  bool new_line = true;
-  ushort lattr = LATTR_NORM;
-  for (uint i = 0; i < buf->len; i++) {
-    if (!buf->text[i] || buf->text[i] == '\r' || buf->text[i] == '\n'
-        // buf->cattrs[i] ~!= buf->cattrs[i0] ?
-        // we need to check more than termattrs_equal_fg
-        // but less than termchars_equal_override
+  // attributes ignored for runs of equal attributes
 # define IGNATTR (TATTR_WIDE | TATTR_COMBINING)
-        || (buf->cattrs[i].attr & ~IGNATTR) != (buf->cattrs[i0].attr & ~IGNATTR)
-        || buf->cattrs[i].truefg != buf->cattrs[i0].truefg
-        || buf->cattrs[i].truebg != buf->cattrs[i0].truebg
-        || buf->cattrs[i].ulcolr != buf->cattrs[i0].ulcolr
-       )
-    {
-      if (new_line) {
-        wchar * nl = wcschr(&buf->text[i], '\n');
-        if (nl) {
-          int offset = nl - &buf->text[i];
-          lattr = (ushort)buf->cattrs[i + offset].link & LATTR_MODE;
-        }
-        else
-          lattr = LATTR_NORM;
-        if (lattr)
-          hprintf(hf, "<div class='double-%s'>",
-                      lattr == LATTR_WIDE ? "width" :
-                      lattr == LATTR_TOP ? "height-top" : "height-bottom");
-        new_line = false;
-      }
 
-      // flush chunk with equal attributes
-      hprintf(hf, "<span class='%s", odd ? "od" : "ev");
-
-      cattr * ca = &buf->cattrs[i0];
-      int fgi = (ca->attr & ATTR_FGMASK) >> ATTR_FGSHIFT;
-      int bgi = (ca->attr & ATTR_BGMASK) >> ATTR_BGSHIFT;
-      bool dim = ca->attr & ATTR_DIM;
-      bool rev = ca->attr & ATTR_REVERSE;
-
-      // colour setup preparations;
-      // we could perhaps reuse apply_attr_colour here, but again 
-      // the situation is specific: some terminal handling (manual bolding) 
-      // is not applicable in HTML export, and we do not want to simply 
-      // always retrieve a plain colour value because we want to specify 
-      // colour style or class only if the respective default is overridden
-      colour fg = fgi >= TRUE_COLOUR ? ca->truefg : win_get_colour(fgi);
-      colour bg = bgi >= TRUE_COLOUR ? ca->truebg : win_get_colour(bgi);
-      // separate ANSI values subject to BoldAsColour
-      int fga = fgi >= ANSI0 ? fgi & 0xFF : 999;
-      int bga = bgi >= ANSI0 ? bgi & 0xFF : 999;
-      if ((ca->attr & ATTR_BOLD) && fga < 8 && term.enable_bold_colour && !rev) {
-        if (bold_colour != (colour)-1)
-          fg = bold_colour;
-      }
-      else if ((ca->attr & (ATTR_BLINK | ATTR_BLINK2)) && term.enable_blink_colour) {
-        if (blink_colour != (colour)-1)
-          fg = blink_colour;
-      }
-      if (dim) {
-        fg = ((fg & 0xFEFEFEFE) >> 1)
-             // dim against terminal bg (as in apply_attr_colour)
-             + ((win_get_colour(BG_COLOUR_I) & 0xFEFEFEFE) >> 1);
-      }
-      if (rev) {
-        fgi ^= bgi; fga ^= bga; fg ^= bg;
-        bgi ^= fgi; bga ^= fga; bg ^= fg;
-        fgi ^= bgi; fga ^= bga; fg ^= bg;
+  /*
+     Span attributes of a run of characters with attributes ca, 
+     computed once for each distinct combination of attributes.
+     With styleclasses, the style declarations are collected into 
+     a table of classes that is emitted after the text.
+   */
+  typedef struct {
+    cattrflags attr;
+    colour truefg, truebg, ulcolr;
+    char * cls;  // further classes
+    char * sty;  // style declarations
+    char * ext;  // further attributes
+    int styi;    // index of style class
+  } htmlstyle;
+  htmlstyle * styles = 0;  // hash table
+  uint nstyles = 0, styles_size = 0;
+  char ** styclasses = 0;  // distinct style declarations
+  int * styslots = 0;      // hash table of styclasses indexes + 1
+  uint nstyclasses = 0, styslots_size = 0;
+  bool styleclasses = hf;  // clipboard consumers may not take styles by class
+
+  void
+  addf(char ** s, const char * fmt, ...)
+  {
+    char * add;
+    va_list va;
+    va_start(va, fmt);
+    vasprintf(&add, fmt, va);
+    va_end(va);
+    strappend(*s, add);
+    free(add);
+  }
+
+  uint
+  strhash(char * s)
+  {
+    uint h = 2166136261u;
+    while (*s)
+      h = (h ^ (uchar)*s++) * 16777619u;
+    return h;
+  }
+
+  uint
+  attrhash(cattrflags attr, colour truefg, colour truebg, colour ulcolr)
+  {
+    unsigned long long h = attr * 0x9E3779B97F4A7C15ull;
+    h ^= ((unsigned long long)truefg << 32 | truebg) * 0xC2B2AE3D27D4EB4Full;
+    h ^= ulcolr * 0x165667B19E3779F9ull;
+    return h ^ h >> 32;
+  }
+
+  int
+  styclass(char * sty)
+  {
+    if (2 * nstyclasses >= styslots_size) {
+      styslots_size = styslots_size ? styslots_size * 2 : 256;
+      styslots = renewn(styslots, styslots_size);
+      memset(styslots, 0, styslots_size * sizeof(int));
+      for (uint k = 0; k < nstyclasses; k++) {
+        uint h = strhash(styclasses[k]) & (styslots_size - 1);
+        while (styslots[h])
+          h = (h + 1) & (styslots_size - 1);
+        styslots[h] = k + 1;
       }
-      cattr ac = apply_attr_colour(*ca, ACM_TERM);
-      fg = ac.truefg;
-      bg = ac.truebg;
-
-      // add marker classes
-      if (ca->attr & ATTR_FRAMED)
-        hprintf(hf, " emoji");  // mark emoji style
-
-      // add subscript or superscript
-      if ((ca->attr & (ATTR_SUBSCR | ATTR_SUPERSCR)) == (ATTR_SUBSCR | ATTR_SUPERSCR))
-        hprintf(hf, " small");
-      else if (ca->attr & ATTR_SUBSCR)
-        hprintf(hf, " sub");
-      else if (ca->attr & ATTR_SUPERSCR)
-        hprintf(hf, " super");
-
-      // style adding function
-      bool with_style = false;
-      void add_style(char * s) {
-        if (!with_style) {
-          hprintf(hf, "' style='%s", s);
-          with_style = true;
+      styclasses = renewn(styclasses, styslots_size / 2);
+    }
+    uint h = strhash(sty) & (styslots_size - 1);
+    while (styslots[h]) {
+      if (!strcmp(styclasses[styslots[h] - 1], sty))
+        return styslots[h] - 1;
+      h = (h + 1) & (styslots_size - 1);
+    }
+    styclasses[nstyclasses] = strdup(sty);
+    styslots[h] = ++nstyclasses;
+    return nstyclasses - 1;
+  }
+
+  htmlstyle *
+  html_style(cattr * ca)
+  {
+    if (2 * nstyles >= styles_size) {
+      htmlstyle * old = styles;
+      uint old_size = styles_size;
+      styles_size = styles_size ? styles_size * 2 : 256;
+      styles = newn(htmlstyle, styles_size);
+      for (uint k = 0; k < styles_size; k++)
+        styles[k].cls = 0;
+      for (uint k = 0; k < old_size; k++)
+        if (old[k].cls) {
+          uint h = attrhash(old[k].attr, old[k].truefg, old[k].truebg, 
+                            old[k].ulcolr) & (styles_size - 1);
+          while (styles[h].cls)
+            h = (h + 1) & (styles_size - 1);
+          styles[h] = old[k];
         }
-        else
-          hprintf(hf, " %s", s);
-      }
-      void add_color(char * pre, int col) {
-        colour ansii = win_get_colour(ANSI0 + col);
-        uchar r = red(ansii), g = green(ansii), b = blue(ansii);
-        add_style("");
-        hprintf(hf, "%scolor: #%02X%02X%02X;", pre, r, g, b);
-      }
+      free(old);
+    }
+    cattrflags attr = ca->attr & ~IGNATTR;
+    uint h = attrhash(attr, ca->truefg, ca->truebg, ca->ulcolr) & (styles_size - 1);
+    while (styles[h].cls) {
+      htmlstyle * hs = &styles[h];
+      if (hs->attr == attr && hs->truefg == ca->truefg
+          && hs->truebg == ca->truebg && hs->ulcolr == ca->ulcolr)
+        return hs;
+      h = (h + 1) & (styles_size - 1);
+    }
 
-      // add style classes or resolved styles;
-      // explicit style= attributes instead of xterm-compatible classes
-      // are used for the sake of tools that do not take styles by class
-      // (Powerpoint; Word would take id= but not class=)
-      if (ca->attr & ATTR_BOLD) {
-        if (enhtml)
-          add_style("font-weight: bold;");
-        else
-          hprintf(hf, " bd");
-      }
-      if (ca->attr & ATTR_ITALIC) {
-        if (enhtml)
-          add_style("font-style: italic;");
-        else
-          hprintf(hf, " it");
-      }
-      if (!enhtml) {
-        if ((ca->attr & (ATTR_UNDER | ATTR_STRIKEOUT)) == (ATTR_UNDER | ATTR_STRIKEOUT))
-          hprintf(hf, " lu");
-        else if (ca->attr & ATTR_STRIKEOUT)
-          hprintf(hf, " st");
-        else if (ca->attr & UNDER_MASK)
-          hprintf(hf, " ul");
-      }
-      int findex = (ca->attr & FONTFAM_MASK) >> ATTR_FONTFAM_SHIFT;
-      if (findex > 10)
-        findex = 0;
-      if (findex) {
-        if (enhtml) {
-          if (*cfg.fontfams[findex].name || findex == 10) {
-            add_style("font-family: ");
-            if (*cfg.fontfams[findex].name) {
-              char * fn = cs__wcstoutf(cfg.fontfams[findex].name);
-              hprintf(hf, "\"%s\";", fn);
-              free(fn);
-            }
-            else
-              hprintf(hf, "\"F25 Blackletter Typewriter\";");
+    htmlstyle * hs = &styles[h];
+    *hs = (htmlstyle){.attr = attr, .truefg = ca->truefg, 
+                      .truebg = ca->truebg, .ulcolr = ca->ulcolr, 
+                      .cls = strdup(""), .sty = strdup(""), .ext = strdup("")};
+    nstyles++;
+
+    int fgi = (ca->attr & ATTR_FGMASK) >> ATTR_FGSHIFT;
+    int bgi = (ca->attr & ATTR_BGMASK) >> ATTR_BGSHIFT;
+    bool dim = ca->attr & ATTR_DIM;
+    bool rev = ca->attr & ATTR_REVERSE;
+
+    // colour setup preparations;
+    // we could perhaps reuse apply_attr_colour here, but again 
+    // the situation is specific: some terminal handling (manual bolding) 
+    // is not applicable in HTML export, and we do not want to simply 
+    // always retrieve a plain colour value because we want to specify 
+    // colour style or class only if the respective default is overridden
+    colour fg = fgi >= TRUE_COLOUR ? ca->truefg : win_get_colour(fgi);
+    colour bg = bgi >= TRUE_COLOUR ? ca->truebg : win_get_colour(bgi);
+    // separate ANSI values subject to BoldAsColour
+    int fga = fgi >= ANSI0 ? fgi & 0xFF : 999;
+    int bga = bgi >= ANSI0 ? bgi & 0xFF : 999;
+    if ((ca->attr & ATTR_BOLD) && fga < 8 && term.enable_bold_colour && !rev) {
+      if (bold_colour != (colour)-1)
+        fg = bold_colour;
+    }
+    else if ((ca->attr & (ATTR_BLINK | ATTR_BLINK2)) && term.enable_blink_colour) {
+      if (blink_colour != (colour)-1)
+        fg = blink_colour;
+    }
+    if (dim) {
+      fg = ((fg & 0xFEFEFEFE) >> 1)
+           // dim against terminal bg (as in apply_attr_colour)
+           + ((win_get_colour(BG_COLOUR_I) & 0xFEFEFEFE) >> 1);
+    }
+    if (rev) {
+      fgi ^= bgi; fga ^= bga; fg ^= bg;
+      bgi ^= fgi; bga ^= fga; bg ^= fg;
+      fgi ^= bgi; fga ^= bga; fg ^= bg;
+    }
+    cattr ac = apply_attr_colour(*ca, ACM_TERM);
+    fg = ac.truefg;
+    bg = ac.truebg;
+
+    // add marker classes
+    if (ca->attr & ATTR_FRAMED)
+      addf(&hs->cls, " emoji");  // mark emoji style
+
+    // add subscript or superscript
+    if ((ca->attr & (ATTR_SUBSCR | ATTR_SUPERSCR)) == (ATTR_SUBSCR | ATTR_SUPERSCR))
+      addf(&hs->cls, " small");
+    else if (ca->attr & ATTR_SUBSCR)
+      addf(&hs->cls, " sub");
+    else if (ca->attr & ATTR_SUPERSCR)
+      addf(&hs->cls, " super");
+
+    // style adding function
+    bool with_style = false;
+    void add_style(char * s) {
+      addf(&hs->sty, with_style ? " %s" : "%s", s);
+      with_style = true;
+    }
+    void add_color(char * pre, int col) {
+      colour ansii = win_get_colour(ANSI0 + col);
+      uchar r = red(ansii), g = green(ansii), b = blue(ansii);
+      add_style("");
+      addf(&hs->sty, "%scolor: #%02X%02X%02X;", pre, r, g, b);
+    }
+
+    // add style classes or resolved styles;
+    // explicit style= attributes instead of xterm-compatible classes
+    // are used for the sake of tools that do not take styles by class
+    // (Powerpoint; Word would take id= but not class=)
+    if (ca->attr & ATTR_BOLD) {
+      if (enhtml)
+        add_style("font-weight: bold;");
+      else
+        addf(&hs->cls, " bd");
+    }
+    if (ca->attr & ATTR_ITALIC) {
+      if (enhtml)
+        add_style("font-style: italic;");
+      else
+        addf(&hs->cls, " it");
+    }
+    if (!enhtml) {
+      if ((ca->attr & (ATTR_UNDER | ATTR_STRIKEOUT)) == (ATTR_UNDER | ATTR_STRIKEOUT))
+        addf(&hs->cls, " lu");
+      else if (ca->attr & ATTR_STRIKEOUT)
+        addf(&hs->cls, " st");
+      else if (ca->attr & UNDER_MASK)
+        addf(&hs->cls, " ul");
+    }
+    int findex = (ca->attr & FONTFAM_MASK) >> ATTR_FONTFAM_SHIFT;
+    if (findex > 10)
+      findex = 0;
+    if (findex) {
+      if (enhtml) {
+        if (*cfg.fontfams[findex].name || findex == 10) {
+          add_style("font-family: ");
+          if (*cfg.fontfams[findex].name) {
+            char * fn = cs__wcstoutf(cfg.fontfams[findex].name);
+            addf(&hs->sty, "\"%s\";", fn);
+            free(fn);
           }
+          else
+            addf(&hs->sty, "\"F25 Blackletter Typewriter\";");
         }
-        else
-          hprintf(hf, " font%d", findex);
       }
+      else
+        addf(&hs->cls, " font%d", findex);
+    }
 
-      // catch and verify predefined colours and apply their colour classes
-      if (fgi == FG_COLOUR_I) {
-        if ((ca->attr & ATTR_BOLD) && term.enable_bold_colour) {
-          if (fg == bold_colour) {
-            if (enhtml) {
-              add_style("color: ");
-              hprintf(hf, "#%02X%02X%02X;",
-                      red(bold_colour), green(bold_colour), blue(bold_colour));
-            }
-            else
-              hprintf(hf, " bold-color");
-            fg = (colour)-1;
+    // catch and verify predefined colours and apply their colour classes
+    if (fgi == FG_COLOUR_I) {
+      if ((ca->attr & ATTR_BOLD) && term.enable_bold_colour) {
+        if (fg == bold_colour) {
+          if (enhtml) {
+            add_style("color: ");
+            addf(&hs->sty, "#%02X%02X%02X;",
+                    red(bold_colour), green(bold_colour), blue(bold_colour));
           }
+          else
+            addf(&hs->cls, " bold-color");
+          fg = (colour)-1;
         }
-        else if (ca->attr & (ATTR_BLINK | ATTR_BLINK2) && term.enable_blink_colour) {
-          if (fg == blink_colour) {
-            if (enhtml) {
-              add_style("color: ");
-              hprintf(hf, "#%02X%02X%02X;",
-                      red(blink_colour), green(blink_colour), blue(blink_colour));
-            }
-            else
-              hprintf(hf, " blink-color");
-            fg = (colour)-1;
+      }
+      else if (ca->attr & (ATTR_BLINK | ATTR_BLINK2) && term.enable_blink_colour) {
+        if (fg == blink_colour) {
+          if (enhtml) {
+            add_style("color: ");
+            addf(&hs->sty, "#%02X%02X%02X;",
+                    red(blink_colour), green(blink_colour), blue(blink_colour));
           }
-        }
-        else if (fg == fg_colour)
+          else
+            addf(&hs->cls, " blink-color");
           fg = (colour)-1;
+        }
       }
-      else if (fga < 8 && cfg.bold_as_colour && (ca->attr & ATTR_BOLD)
-               && fg == win_get_colour(ANSI0 + fga + 8)
-              )
-      {
-        if (enhtml)
-          add_color("", fga + 8);
-        else
-          hprintf(hf, " fg-color%d", fga + 8);
-        fg = (colour)-1;
-      }
-      else if (fga < 16 && fg == win_get_colour(ANSI0 + fga)) {
-        if (enhtml)
-          add_color("", fga);
-        else
-          hprintf(hf, " fg-color%d", fga);
+      else if (fg == fg_colour)
         fg = (colour)-1;
-      }
-      if (bgi == BG_COLOUR_I && bg == bg_colour)
-        bg = (colour)-1;
-      else if (bga < 16 && bg == win_get_colour(ANSI0 + bga)) {
-        if (enhtml)
-          add_color("background-", bga);
-        else
-          hprintf(hf, " bg-color%d", bga);
-        bg = (colour)-1;
-      }
+    }
+    else if (fga < 8 && cfg.bold_as_colour && (ca->attr & ATTR_BOLD)
+             && fg == win_get_colour(ANSI0 + fga + 8)
+            )
+    {
+      if (enhtml)
+        add_color("", fga + 8);
+      else
+        addf(&hs->cls, " fg-color%d", fga + 8);
+      fg = (colour)-1;
+    }
+    else if (fga < 16 && fg == win_get_colour(ANSI0 + fga)) {
+      if (enhtml)
+        add_color("", fga);
+      else
+        addf(&hs->cls, " fg-color%d", fga);
+      fg = (colour)-1;
+    }
+    if (bgi == BG_COLOUR_I && bg == bg_colour)
+      bg = (colour)-1;
+    else if (bga < 16 && bg == win_get_colour(ANSI0 + bga)) {
+      if (enhtml)
+        add_color("background-", bga);
+      else
+        addf(&hs->cls, " bg-color%d", bga);
+      bg = (colour)-1;
+    }
 
-      // add individual styles
+    // add individual styles
 
-      // add individual colours, or fix unmatched colours
-      if (fg != (colour)-1) {
-        uchar r = red(fg), g = green(fg), b = blue(fg);
-        add_style("");
-        hprintf(hf, "color: #%02X%02X%02X;", r, g, b);
-      }
-      if (bg != (colour)-1) {
-        uchar r = red(bg), g = green(bg), b = blue(bg);
-        add_style("");
-        hprintf(hf, "background-color: #%02X%02X%02X;", r, g, b);
-      }
+    // add individual colours, or fix unmatched colours
+    if (fg != (colour)-1) {
+      uchar r = red(fg), g = green(fg), b = blue(fg);
+      add_style("");
+      addf(&hs->sty, "color: #%02X%02X%02X;", r, g, b);
+    }
+    if (bg != (colour)-1) {
+      uchar r = red(bg), g = green(bg), b = blue(bg);
+      add_style("");
+      addf(&hs->sty, "background-color: #%02X%02X%02X;", r, g, b);
+    }
 
-      if (enhtml && (ca->attr & (UNDER_MASK | ATTR_STRIKEOUT | ATTR_OVERL))) {
-        // add explicit style= lining attributes for the sake of tools 
-        // that do not take styles by class (Powerpoint)
-        add_style("text-decoration:");
-        if (ca->attr & UNDER_MASK)
-          hprintf(hf, " underline");
-        if (ca->attr & ATTR_STRIKEOUT)
-          hprintf(hf, " line-through");
-        if (ca->attr & ATTR_OVERL)
-          hprintf(hf, " overline");
-        hprintf(hf, ";");
-      }
-      else if (ca->attr & ATTR_OVERL) {
-        add_style("text-decoration-line: overline");
-        if (ca->attr & ATTR_STRIKEOUT)
-          hprintf(hf, " line-through");
-        if (ca->attr & ATTR_UNDER)
-          hprintf(hf, " underline");
-        hprintf(hf, ";");
-      }
-      if (ca->attr & ATTR_BROKENUND)
-        if (ca->attr & ATTR_DOUBLYUND)
-          add_style("text-decoration-style: dashed;");
-        else
-          add_style("text-decoration-style: dotted;");
-      else if ((ca->attr & UNDER_MASK) == ATTR_CURLYUND)
-        add_style("text-decoration-style: wavy;");
-      else if ((ca->attr & UNDER_MASK) == ATTR_DOUBLYUND)
-        add_style("text-decoration-style: double;");
-
-      colour ul = (ca->attr & ATTR_ULCOLOUR) ? ca->ulcolr : cfg.underl_colour;
-      if (ul != (colour)-1 && (ca->attr & (UNDER_MASK | ATTR_STRIKEOUT | ATTR_OVERL))) {
-        uchar r = red(ul), g = green(ul), b = blue(ul);
-        add_style("");
-        hprintf(hf, "text-decoration-color: #%02X%02X%02X;", r, g, b);
-      }
+    if (enhtml && (ca->attr & (UNDER_MASK | ATTR_STRIKEOUT | ATTR_OVERL))) {
+      // add explicit style= lining attributes for the sake of tools 
+      // that do not take styles by class (Powerpoint)
+      add_style("text-decoration:");
+      if (ca->attr & UNDER_MASK)
+        addf(&hs->sty, " underline");
+      if (ca->attr & ATTR_STRIKEOUT)
+        addf(&hs->sty, " line-through");
+      if (ca->attr & ATTR_OVERL)
+        addf(&hs->sty, " overline");
+      addf(&hs->sty, ";");
+    }
+    else if (ca->attr & ATTR_OVERL) {
+      add_style("text-decoration-line: overline");
+      if (ca->attr & ATTR_STRIKEOUT)
+        addf(&hs->sty, " line-through");
+      if (ca->attr & ATTR_UNDER)
+        addf(&hs->sty, " underline");
+      addf(&hs->sty, ";");
+    }
+    if (ca->attr & ATTR_BROKENUND)
+      if (ca->attr & ATTR_DOUBLYUND)
+        add_style("text-decoration-style: dashed;");
+      else
+        add_style("text-decoration-style: dotted;");
+    else if ((ca->attr & UNDER_MASK) == ATTR_CURLYUND)
+      add_style("text-decoration-style: wavy;");
+    else if ((ca->attr & UNDER_MASK) == ATTR_DOUBLYUND)
+      add_style("text-decoration-style: double;");
+
+    colour ul = (ca->attr & ATTR_ULCOLOUR) ? ca->ulcolr : cfg.underl_colour;
+    if (ul != (colour)-1 && (ca->attr & (UNDER_MASK | ATTR_STRIKEOUT | ATTR_OVERL))) {
+      uchar r = red(ul), g = green(ul), b = blue(ul);
+      add_style("");
+      addf(&hs->sty, "text-decoration-color: #%02X%02X%02X;", r, g, b);
+    }
 
-      if (ca->attr & ATTR_INVISIBLE)
-        add_style("opacity: 0;");
-      else {
-        // add JavaScript triggers
-        if (ca->attr & ATTR_BLINK2)
-          hprintf(hf, "' name='rapid");
-        else if (ca->attr & ATTR_BLINK)
-          hprintf(hf, "' name='blink");
-      }
+    if (ca->attr & ATTR_INVISIBLE)
+      add_style("opacity: 0;");
+    else {
+      // add JavaScript triggers
+      if (ca->attr & ATTR_BLINK2)
+        addf(&hs->ext, "' name='rapid");
+      else if (ca->attr & ATTR_BLINK)
+        addf(&hs->ext, "' name='blink");
+    }
 
-      // mark cursor position
-      if (ca->attr & (TATTR_ACTCURS | TATTR_PASCURS)) {
-        hprintf(hf, "' id='cursor");
-        fg = win_get_colour(CURSOR_TEXT_COLOUR_I);
-        // more precise cursor colour adjustments could be made...
-      }
+    // mark cursor position
+    if (ca->attr & (TATTR_ACTCURS | TATTR_PASCURS)) {
+      addf(&hs->ext, "' id='cursor");
+      // more precise cursor colour adjustments could be made...
+    }
 
-      // finish styles
-      hprintf(hf, "'>");
-
-      // retrieve chunk of text from buffer
-      wchar save = buf->text[i];
-      buf->text[i] = 0;
-      char * s = cs__wcstoutf(&buf->text[i0]);
-      buf->text[i] = save;
-      // here we could:
-      // * handle the chunk string by Unicode glyphs
-      // * check whether each char is an emoji char or sequence
-      // * check its terminal width
-      // * scale width to actual (narrow or multi-cell) width
-
-      // write chunk, apply HTML escapes
-      void hprinttext(char * t) {
-        if (ca->attr & ATTR_FRAMED)
-          while (*t) {
-            hprintf(hf, "%c", *t++);
-#ifdef export_emoji_style
-            // here we should, in addition to the above:
-            // * check whether each char actually has an emoji presentation:
-            //   (emoji_tags(emoji_idx(ch)) & EM_emoj)
-            //   and only append 0xFE0F then
-            if ((*t & 0xC0) != 0x80)
-              hprintf(hf, "️");
-#endif
-          }
-        else
-          hprintf(hf, "%s", t);
-      }
-      char * s1 = strpbrk(s, "<&");
-      if (s1) {
-        char * s0 = s;
-        do {
-          if (*s0 == '<') {
-            hprintf(hf, "&lt;");
-            s0 ++;
-          }
-          else if (*s0 == '&') {
-            hprintf(hf, "&amp;");
-            s0 ++;
+    if (styleclasses && *hs->sty)
+      hs->styi = styclass(hs->sty);
+    return hs;
+  }
+
+  // convert the selection chunk by chunk, as collected by get_selection
+  bool odd = true;
+  bool new_line = true;
+  ushort lattr = LATTR_NORM;
+  void html_chunk(clip_workbuf * buf)
+  {
+    int i0 = 0;
+    for (uint i = 0; i < buf->len; i++) {
+      if (!buf->text[i] || buf->text[i] == '\r' || buf->text[i] == '\n'
+          // buf->cattrs[i] ~!= buf->cattrs[i0] ?
+          // we need to check more than termattrs_equal_fg
+          // but less than termchars_equal_override
+          || (buf->cattrs[i].attr & ~IGNATTR) != (buf->cattrs[i0].attr & ~IGNATTR)
+          || buf->cattrs[i].truefg != buf->cattrs[i0].truefg
+          || buf->cattrs[i].truebg != buf->cattrs[i0].truebg
+          || buf->cattrs[i].ulcolr != buf->cattrs[i0].ulcolr
+         )
+      {
+        if (new_line) {
+          wchar * nl = wcschr(&buf->text[i], '\n');
+          if (nl) {
+            int offset = nl - &buf->text[i];
+            lattr = (ushort)buf->cattrs[i + offset].link & LATTR_MODE;
           }
-          else {
-            char c = s1 ? *s1 : 0;
-            if (s1)
-              *s1 = 0;
-            hprinttext(s0);
-            if (s1) {
-              *s1 = c;
-              s0 = s1;
+          else
+            lattr = LATTR_NORM;
+          if (lattr)
+            hprintf(hf, "<div class='double-%s'>",
+                        lattr == LATTR_WIDE ? "width" :
+                        lattr == LATTR_TOP ? "height-top" : "height-bottom");
+          new_line = false;
+        }
+
+        // flush chunk with equal attributes
+        cattr * ca = &buf->cattrs[i0];
+        htmlstyle * hs = html_style(ca);
+        hprintf(hf, "<span class='%s%s", odd ? "od" : "ev", hs->cls);
+        if (*hs->sty) {
+          if (styleclasses)
+            hprintf(hf, " s%d", hs->styi);
+          else
+            hprintf(hf, "' style='%s", hs->sty);
+        }
+
+        // finish styles
+        hprintf(hf, "%s'>", hs->ext);
+
+        // retrieve chunk of text from buffer
+        wchar save = buf->text[i];
+        buf->text[i] = 0;
+        char * s = cs__wcstoutf(&buf->text[i0]);
+        buf->text[i] = save;
+        // here we could:
+        // * handle the chunk string by Unicode glyphs
+        // * check whether each char is an emoji char or sequence
+        // * check its terminal width
+        // * scale width to actual (narrow or multi-cell) width
+
+        // write chunk, apply HTML escapes
+        void hprinttext(char * t) {
+          if (ca->attr & ATTR_FRAMED)
+            while (*t) {
+              hprintf(hf, "%c", *t++);
+  #ifdef export_emoji_style
+              // here we should, in addition to the above:
+              // * check whether each char actually has an emoji presentation:
+              //   (emoji_tags(emoji_idx(ch)) & EM_emoj)
+              //   and only append 0xFE0F then
+              if ((*t & 0xC0) != 0x80)
+                hprintf(hf, "️");
+  #endif
             }
-            else
-              s0 += strlen(s0);
-          }
-          s1 = strpbrk(s0, "<&");
-        } while (*s0);
-      }
-      else
-        hprinttext(s);
-      free(s);
-      hprintf(hf, "</span>");
+          else
+            hprintf(hf, "%s", t);
+        }
+        char * s1 = strpbrk(s, "<&");
+        if (s1) {
+          char * s0 = s;
+          do {
+            if (*s0 == '<') {
+              hprintf(hf, "&lt;");
+              s0 ++;
+            }
+            else if (*s0 == '&') {
+              hprintf(hf, "&amp;");
+              s0 ++;
+            }
+            else {
+              char c = s1 ? *s1 : 0;
+              if (s1)
+                *s1 = 0;
+              hprinttext(s0);
+              if (s1) {
+                *s1 = c;
+                s0 = s1;
+              }
+              else
+                s0 += strlen(s0);
+            }
+            s1 = strpbrk(s0, "<&");
+          } while (*s0);
+        }
+        else
+          hprinttext(s);
+        free(s);
+        hprintf(hf, "</span>");
 
-      // forward chunk pointer
-      i0 = i;
-    }
+        // forward chunk pointer
+        i0 = i;
+      }
 
-    // forward newlines
-    if (buf->text[i] == '\r') {
-      i++;
-      i0 = i;
-    }
-    if (buf->text[i] == '\n') {
-      i++;
-      i0 = i;
-      if (lattr)
-        hprintf(hf, "</div>");
-      if (enhtml)
-        // <br> needed for HTML and for Powerpoint
-        hprintf(hf, "<br%s\n>", lattr == LATTR_BOT ? " class='double-height-bottom'" : "");
-      else
-        hprintf(hf, "\n");
-      odd = !odd;
+      // forward newlines
+      if (buf->text[i] == '\r') {
+        i++;
+        i0 = i;
+      }
+      if (buf->text[i] == '\n') {
+        i++;
+        i0 = i;
+        if (lattr)
+          hprintf(hf, "</div>");
+        if (enhtml)
+          // <br> needed for HTML and for Powerpoint
+          hprintf(hf, "<br%s\n>", lattr == LATTR_BOT ? " class='double-height-bottom'" : "");
+        else
+          hprintf(hf, "\n");
+        odd = !odd;
 
-      new_line = true;
-      lattr = LATTR_NORM;
+        new_line = true;
+        lattr = LATTR_NORM;
+      }
     }
   }
+  clip_workbuf * buf = get_selection(true, start, end, rect, level >= 3, false, html_chunk);
   destroy_clip_workbuf(buf, true);
 
   hprintf(hf, "</pre>\n");
   hprintf(hf, "  </div>\n");
   //hprintf(hf, "  </td></tr></table>\n");
+
+  // the style classes are only known now; browsers apply them anyway
+  if (nstyclasses) {
+    hprintf(hf, "  <style type='text/css'>\n");
+    for (uint k = 0; k < nstyclasses; k++) {
+      // #vt100 for precedence over the '#vt100 span' style
+      hprintf(hf, "  #vt100 .s%d { %s }\n", k, styclasses[k]);
+      free(styclasses[k]);
+    }
+    hprintf(hf, "  </style>\n");
+  }
+  free(styclasses);
+  free(styslots);
+  for (uint k = 0; k < styles_size; k++)
+    if (styles[k].cls) {
+      free(styles[k].cls);
+      free(styles[k].sty);
+      free(styles[k].ext);
+    }
+  free(styles);
+
   hprintf(hf, "</body>\n");
 
   return hbuf;
@@ -1316,8 +1514,11 @@ print_screen(void)
   pos start = (pos){term.disptop, 0, 0, 0, false};
   pos end = (pos){term.disptop + term.rows - 1, term.cols, 0, 0, false};
   bool rect = false;
-  clip_workbuf * buf = get_selection(false, start, end, rect, false, false);
-  printer_wwrite(buf->text, buf->len);
+  void print_chunk(clip_workbuf * buf)
+  {
+    printer_wwrite(buf->text, buf->len);
+  }
+  clip_workbuf * buf = get_selection(false, start, end, rect, false, false, print_chunk);
   printer_finish_job();
   destroy_clip_workbuf(buf, true);
 }
@@ -0,0 +1,197 @@
+// termdamage.c (part of mintty)
+// Licensed under the terms of the GNU General Public License v3 or later.
+
+#include "termdamage.h"
+
+/*
+ * Display damage, accumulated per frame:
+ * the terminal notes scroll moves of the display contents and
+ * cell rectangles to be painted, the window layer applies the moves
+ * (damage_move_applied) or leaves them to be repainted (damage_drop_moves).
+ * This does not depend on the terminal state, so it can be tested headless.
+ */
+
+/*
+ * Set the display size; all of the display is damaged.
+ */
+void
+damage_resize(termdamage * dm, int rows, int cols)
+{
+  dm->rows = rows;
+  dm->cols = cols;
+  damage_clear(dm);
+  damage_add(dm, 0, 0, rows - 1, cols - 1);
+}
+
+/*
+ * Note the cells of the given display area as damaged.
+ */
+void
+damage_add(termdamage * dm, int top, int left, int bottom, int right)
+{
+  top = max(top, 0);
+  left = max(left, 0);
+  bottom = min(bottom, dm->rows - 1);
+  right = min(right, dm->cols - 1);
+  if (top > bottom || left > right)
+    return;
+
+  damage_rect new = {top, left, bottom, right};
+  for (int k = 0; k < dm->rects_len; k++) {
+    damage_rect * r = &dm->rects[k];
+    if (r->top <= new.top && r->bottom >= new.bottom
+        && r->left <= new.left && r->right >= new.right)
+      return;  // already covered
+    bool cover = new.top <= r->top && new.bottom >= r->bottom
+                 && new.left <= r->left && new.right >= r->right;
+    // same columns, rows overlapping or adjoining
+    bool vjoin = r->left == new.left && r->right == new.right
+                 && new.top <= r->bottom + 1 && r->top <= new.bottom + 1;
+    // same rows, columns overlapping or adjoining
+    bool hjoin = r->top == new.top && r->bottom == new.bottom
+                 && new.left <= r->right + 1 && r->left <= new.right + 1;
+    if (cover || vjoin || hjoin) {
+      new.top = min(new.top, r->top);
+      new.left = min(new.left, r->left);
+      new.bottom = max(new.bottom, r->bottom);
+      new.right = max(new.right, r->right);
+      // drop the absorbed rectangle and check the others again
+      *r = dm->rects[--dm->rects_len];
+      k = -1;
+    }
+  }
+
+  if (dm->rects_len == DAMAGE_MAX_RECTS) {
+    // merge with the rectangle whose bounding box grows least
+    int best = 0;
+    long best_growth = LONG_MAX;
+    for (int k = 0; k < dm->rects_len; k++) {
+      damage_rect * r = &dm->rects[k];
+      long area = (long)(r->bottom - r->top + 1) * (r->right - r->left + 1);
+      long bbox = (long)(max(r->bottom, new.bottom) - min(r->top, new.top) + 1)
+                * (max(r->right, new.right) - min(r->left, new.left) + 1);
+      if (bbox - area < best_growth) {
+        best = k;
+        best_growth = bbox - area;
+      }
+    }
+    damage_rect r = dm->rects[best];
+    dm->rects[best] = dm->rects[--dm->rects_len];
+    damage_add(dm, min(r.top, new.top), min(r.left, new.left),
+                   max(r.bottom, new.bottom), max(r.right, new.right));
+    return;
+  }
+
+  if (dm->rects_len == dm->rects_size) {
+    dm->rects_size = dm->rects_size ? dm->rects_size * 2 : 8;
+    dm->rects = renewn(dm->rects, dm->rects_size);
+  }
+  dm->rects[dm->rects_len++] = new;
+}
+
+/*
+ * Check whether any cell of the given display area is damaged.
+ */
+bool
+damage_test(termdamage * dm, int top, int left, int bottom, int right)
+{
+  for (int k = 0; k < dm->rects_len; k++) {
+    damage_rect * r = &dm->rects[k];
+    if (r->top <= bottom && top <= r->bottom
+        && r->left <= right && left <= r->right)
+      return true;
+  }
+  return false;
+}
+
+/*
+ * Note that the display contents of rows [top, bot) moved up by lines,
+ * or down if lines is negative.
+ */
+void
+damage_move_add(termdamage * dm, int top, int bot, int lines)
+{
+  top = max(top, 0);
+  bot = min(bot, dm->rows);
+  if (top >= bot || !lines)
+    return;
+  int height = bot - top;
+
+  if (dm->moves_len) {
+    damage_move * m = &dm->moves[dm->moves_len - 1];
+    if (m->top == top && m->bot == bot) {
+      // with more than the region height, all contents are replaced
+      m->lines = max(-height, min(m->lines + lines, height));
+      if (!m->lines)
+        dm->moves_len--;
+      return;
+    }
+  }
+
+  if (dm->moves_len == DAMAGE_MAX_MOVES)
+    // too many different regions; repaint them instead
+    damage_drop_moves(dm);
+
+  if (dm->moves_len == dm->moves_size) {
+    dm->moves_size = dm->moves_size ? dm->moves_size * 2 : 4;
+    dm->moves = renewn(dm->moves, dm->moves_size);
+  }
+  dm->moves[dm->moves_len++] = (damage_move){
+    .top = top, .bot = bot, .lines = max(-height, min(lines, height))
+  };
+}
+
+/*
+ * The window has moved its contents as described by the first
+ * pending move: move the damaged cells along, and damage the rows
+ * that were exposed.
+ */
+void
+damage_move_applied(termdamage * dm)
+{
+  if (!dm->moves_len)
+    return;
+  damage_move m = dm->moves[0];
+  dm->moves_len--;
+  memmove(dm->moves, dm->moves + 1, dm->moves_len * sizeof(damage_move));
+
+  int len = dm->rects_len;
+  damage_rect rects[len];
+  memcpy(rects, dm->rects, len * sizeof(damage_rect));
+  dm->rects_len = 0;
+  for (int k = 0; k < len; k++) {
+    damage_rect * r = &rects[k];
+    // parts outside of the region stay
+    damage_add(dm, r->top, r->left, min(r->bottom, m.top - 1), r->right);
+    damage_add(dm, max(r->top, m.bot), r->left, r->bottom, r->right);
+    // the part inside is moved, as far as it stays inside
+    damage_add(dm, max(max(r->top, m.top) - m.lines, m.top), r->left,
+                   min(min(r->bottom, m.bot - 1) - m.lines, m.bot - 1),
+                   r->right);
+  }
+
+  if (m.lines > 0)
+    damage_add(dm, m.bot - m.lines, 0, m.bot - 1, dm->cols - 1);
+  else
+    damage_add(dm, m.top, 0, m.top - m.lines - 1, dm->cols - 1);
+}
+
+/*
+ * The window does not move its contents as noted:
+ * damage the regions of all pending moves instead.
+ */
+void
+damage_drop_moves(termdamage * dm)
+{
+  int len = dm->moves_len;
+  dm->moves_len = 0;
+  for (int k = 0; k < len; k++)
+    damage_add(dm, dm->moves[k].top, 0, dm->moves[k].bot - 1, dm->cols - 1);
+}
+
+void
+damage_clear(termdamage * dm)
+{
+  dm->moves_len = 0;
+  dm->rects_len = 0;
+}
@@ -0,0 +1,45 @@
+#ifndef TERMDAMAGE_H
+#define TERMDAMAGE_H
+
+/*
+ * Display damage, accumulated per frame between the terminal and
+ * the window layer, in display cells.
+ */
+
+typedef struct {
+  // display cells, inclusive
+  short top, left, bottom, right;
+} damage_rect;
+
+typedef struct {
+  // display rows [top, bot) moved up by lines, or down if negative
+  short top, bot;
+  int lines;
+} damage_move;
+
+typedef struct {
+  // display size; set with damage_resize
+  short rows, cols;
+  // Scroll moves of the display contents since the last frame, in order;
+  // consecutive moves of the same region are summed up.
+  damage_move * moves;
+  int moves_len, moves_size;
+  // Cell rectangles to be painted, referring to the display before
+  // the pending moves have been applied (see damage_move_applied);
+  // overlapping or adjoining rectangles are merged.
+  damage_rect * rects;
+  int rects_len, rects_size;
+} termdamage;
+
+#define DAMAGE_MAX_RECTS 64
+#define DAMAGE_MAX_MOVES 16
+
+extern void damage_resize(termdamage *, int rows, int cols);
+extern void damage_add(termdamage *, int top, int left, int bottom, int right);
+extern bool damage_test(termdamage *, int top, int left, int bottom, int right);
+extern void damage_move_add(termdamage *, int top, int bot, int lines);
+extern void damage_move_applied(termdamage *);
+extern void damage_drop_moves(termdamage *);
+extern void damage_clear(termdamage *);
+
+#endif
@@ -22,7 +22,10 @@ newline(int cols, int bce)
   line->cols = line->size = cols;
   line->lattr = LATTR_NORM;
   line->temporary = false;
+  line->refs = 0;
   line->cc_free = 0;
+  line->has_bidi = false;
+  touch_line(line);
   return line;
 }
 
@@ -74,6 +77,12 @@ add_cc(termline *line, int col, wchar chr, cattr attr)
 {
   assert(col >= -1 && col < line->cols);
 
+  wchar base = line->chars[col].chr;
+  if ((chr & 0xFC00) == 0xDC00 && (base & 0xFC00) == 0xD800)
+    mark_bidi(line, ((ucschar)(base - 0xD7C0) << 10) | (chr & 0x03FF));
+  else
+    mark_bidi(line, chr);
+
  /*
   * Start by extending the cols array if the free list is empty.
   */
@@ -180,6 +189,7 @@ copy_termchar(termline *destline, int x, termchar *src)
 
   destline->chars[x] = *src;    /* copy everything except cc-list */
   destline->chars[x].cc_next = 0;       /* and make sure this is zero */
+  mark_bidi(destline, src->chr);
 
   while (src->cc_next) {
     src += src->cc_next;
@@ -205,6 +215,177 @@ move_termchar(termline * line, termchar *dest, termchar *src)
   src->cc_next = 0;
 }
 
+/*
+ * Interned attributes for compressed lines.
+ * Attributes that do not fit the short 3-byte encoding (true colour, 
+ * underline colour, hyperlinks, images, higher attribute bits) are 
+ * stored once in this session-wide table and referred to by index 
+ * from compressed lines. Each occurrence in a compressed line holds 
+ * a reference, so entries are recycled when their lines are discarded.
+ */
+typedef struct {
+  cattr attr;
+  uint refs;
+  bool used;
+  int hnext;    /* hash chain, or free list */
+} attrentry;
+
+static struct {
+  attrentry * entries;
+  int size;     /* allocated entries */
+  int top;      /* entries ever used */
+  int count;    /* entries in use */
+  int freelist;
+  int * hash;
+  int hsize;
+  int shrinkat; /* count below which the table is compacted */
+} attrtab = {.freelist = -1};
+
+/* Memory held by interned attributes, counted in the scrollback budget. */
+long long int
+attrtab_bytes(void)
+{
+  return (long long int)attrtab.count * (sizeof(attrentry) + sizeof(int));
+}
+
+static uint
+attr_hash(cattr * a)
+{
+  unsigned long long h = a->attr;
+  h = h * 31 + a->truefg;
+  h = h * 31 + a->truebg;
+  h = h * 31 + a->ulcolr;
+  h = h * 31 + (uint)a->link;
+  h = h * 31 + (uint)a->imgi;
+  return (uint)(h ^ (h >> 29) ^ (h >> 47));
+}
+
+static bool
+attr_equal(cattr * a, cattr * b)
+{
+  return a->attr == b->attr
+      && a->truefg == b->truefg && a->truebg == b->truebg
+      && a->ulcolr == b->ulcolr
+      && a->link == b->link && a->imgi == b->imgi;
+}
+
+static void
+attr_rehash(int hsize)
+{
+  attrtab.hsize = hsize;
+  attrtab.hash = renewn(attrtab.hash, hsize);
+  for (int i = 0; i < hsize; i++)
+    attrtab.hash[i] = -1;
+  for (int i = 0; i < attrtab.top; i++)
+    if (attrtab.entries[i].used) {
+      int * hp = &attrtab.hash[attr_hash(&attrtab.entries[i].attr) & (hsize - 1)];
+      attrtab.entries[i].hnext = *hp;
+      *hp = i;
+    }
+}
+
+/*
+   Give back memory after many entries have been recycled:
+   trim unused entries off the end (entries in use cannot move, 
+   as compressed lines refer to them by index) and shrink the hash.
+ */
+static void
+attr_shrink(void)
+{
+  if (!attrtab.count) {
+    free(attrtab.entries);
+    free(attrtab.hash);
+    attrtab = (typeof(attrtab)){.freelist = -1};
+    return;
+  }
+
+  while (!attrtab.entries[attrtab.top - 1].used)
+    attrtab.top--;
+  attrtab.freelist = -1;
+  for (int i = attrtab.top - 1; i >= 0; i--)
+    if (!attrtab.entries[i].used) {
+      attrtab.entries[i].hnext = attrtab.freelist;
+      attrtab.freelist = i;
+    }
+  if (attrtab.size > attrtab.top * 2 + 256) {
+    attrtab.size = attrtab.top + 256;
+    attrtab.entries = renewn(attrtab.entries, attrtab.size);
+  }
+
+  int hsize = attrtab.hsize;
+  while (hsize > 256 && attrtab.count < hsize / 4)
+    hsize /= 2;
+  if (hsize != attrtab.hsize)
+    attr_rehash(hsize);
+
+  // entries still in use may pin the table; wait for a further halving
+  attrtab.shrinkat = attrtab.count / 2;
+}
+
+/* Find or add an attribute; references are taken with attr_ref. */
+static int
+attr_intern(cattr * a)
+{
+  if (!attrtab.hsize)
+    attr_rehash(256);
+
+  uint h = attr_hash(a);
+  for (int i = attrtab.hash[h & (attrtab.hsize - 1)]; i >= 0;
+       i = attrtab.entries[i].hnext)
+    if (attr_equal(&attrtab.entries[i].attr, a))
+      return i;
+
+  int i;
+  if (attrtab.freelist >= 0) {
+    i = attrtab.freelist;
+    attrtab.freelist = attrtab.entries[i].hnext;
+  }
+  else {
+    if (attrtab.top == attrtab.size) {
+      attrtab.size = attrtab.size * 2 + 256;
+      attrtab.entries = renewn(attrtab.entries, attrtab.size);
+    }
+    i = attrtab.top++;
+  }
+  attrtab.entries[i].attr = *a;
+  // references are taken when the compressed line is complete
+  attrtab.entries[i].refs = 0;
+  attrtab.entries[i].used = true;
+  attrtab.count++;
+  if (attrtab.count / 4 > attrtab.shrinkat)
+    attrtab.shrinkat = attrtab.count / 4;
+  if (attrtab.count > attrtab.hsize)
+    attr_rehash(attrtab.hsize * 2);
+  else {
+    int * hp = &attrtab.hash[h & (attrtab.hsize - 1)];
+    attrtab.entries[i].hnext = *hp;
+    *hp = i;
+  }
+  return i;
+}
+
+static void
+attr_ref(int i, int delta)
+{
+  assert(i >= 0 && i < attrtab.top);
+  attrentry * e = &attrtab.entries[i];
+  assert(delta > 0 || e->refs >= (uint)-delta);
+  e->refs += delta;
+  if (!e->refs) {
+    // unhash and recycle
+    int * hp = &attrtab.hash[attr_hash(&e->attr) & (attrtab.hsize - 1)];
+    while (*hp != i)
+      hp = &attrtab.entries[*hp].hnext;
+    *hp = e->hnext;
+    e->used = false;
+    e->hnext = attrtab.freelist;
+    attrtab.freelist = i;
+    attrtab.count--;
+    if (attrtab.count < attrtab.shrinkat)
+      attr_shrink();
+  }
+}
+
 static void
 makeliteral_chr(struct buf *buf, termchar *c)
 {
@@ -236,59 +417,36 @@ static void
 makeliteral_attr(struct buf *b, termchar *c)
 {
  /*
-  * My encoding for attributes is 16-bit-granular and assumes
-  * that the top bit of the word is never required. I either
-  * store a two-byte value with the top bit clear (indicating
-  * just that value), or a four-byte value with the top bit set
-  * (indicating the same value with its top bit clear).
-  *
-  * However, first I permute the bits of the attribute value, so
-  * that the eight bits of colour (four in each of fg and bg)
-  * which are never non-zero unless xterm 256-colour mode is in
-  * use are placed higher up the word than everything else. This
-  * ensures that attribute values remain 16-bit _unless_ the
-  * user uses extended colour.
+  * Plain attributes, which only use the lower 23 bits of the 
+  * attribute value with no extended colour or other extensions, 
+  * are stored as a three-byte value with the top bit clear.
+  * Anything else is interned in the attribute table (see attr_intern) 
+  * and stored as its index: a first byte with the top bit set and 
+  * 6 bits of index, with bit 0x40 indicating further 7-bit digits, 
+  * each of which has the top bit set if more follow.
   */
-  cattrflags attr = c->attr.attr & ~DATTR_STARTRUN;  // keep cursor for reflow
-  int link = c->attr.link;
-  int imgi = c->attr.imgi;
-  colour truefg = c->attr.truefg;
-  colour truebg = c->attr.truebg;
-  colour ulcolr = c->attr.ulcolr;
-
-  if (attr < 0x800000 && !truefg && !truebg
-      && link == -1 && !imgi && ulcolr == (colour)-1) {
-    add(b, (uchar) ((attr >> 16) & 0xFF));
-    add(b, (uchar) ((attr >> 8) & 0xFF));
-    add(b, (uchar) (attr & 0xFF));
+  cattr a = c->attr;
+  a.attr &= ~DATTR_STARTRUN;  // keep cursor for reflow
+
+  if (a.attr < 0x800000 && !a.truefg && !a.truebg
+      && a.link == -1 && !a.imgi && a.ulcolr == (colour)-1) {
+    add(b, (uchar) ((a.attr >> 16) & 0xFF));
+    add(b, (uchar) ((a.attr >> 8) & 0xFF));
+    add(b, (uchar) (a.attr & 0xFF));
   }
   else {
-    add(b, (uchar) ((attr >> 56) & 0xFF) | 0x80);
-    add(b, (uchar) ((attr >> 48) & 0xFF));
-    add(b, (uchar) ((attr >> 40) & 0xFF));
-    add(b, (uchar) ((attr >> 32) & 0xFF));
-    add(b, (uchar) ((attr >> 24) & 0xFF));
-    add(b, (uchar) ((attr >> 16) & 0xFF));
-    add(b, (uchar) ((attr >> 8) & 0xFF));
-    add(b, (uchar) (attr & 0xFF));
-    add(b, (uchar) ((link >> 24) & 0xFF));
-    add(b, (uchar) ((link >> 16) & 0xFF));
-    add(b, (uchar) ((link >> 8) & 0xFF));
-    add(b, (uchar) (link & 0xFF));
-    add(b, (uchar) ((imgi >> 24) & 0xFF));
-    add(b, (uchar) ((imgi >> 16) & 0xFF));
-    add(b, (uchar) ((imgi >> 8) & 0xFF));
-    add(b, (uchar) (imgi & 0xFF));
-
-    add(b, (uchar) ((truefg >> 16) & 0xFF));
-    add(b, (uchar) ((truefg >> 8) & 0xFF));
-    add(b, (uchar) (truefg & 0xFF));
-    add(b, (uchar) ((truebg >> 16) & 0xFF));
-    add(b, (uchar) ((truebg >> 8) & 0xFF));
-    add(b, (uchar) (truebg & 0xFF));
-    add(b, (uchar) ((ulcolr >> 16) & 0xFF));
-    add(b, (uchar) ((ulcolr >> 8) & 0xFF));
-    add(b, (uchar) (ulcolr & 0xFF));
+    uint i = attr_intern(&a);
+    if (i < 0x40)
+      add(b, (uchar) (0x80 | i));
+    else {
+      add(b, (uchar) (0xC0 | (i & 0x3F)));
+      i >>= 6;
+      while (i >= 0x80) {
+        add(b, (uchar) ((i & 0x7F) | 0x80));
+        i >>= 7;
+      }
+      add(b, (uchar) i);
+    }
   }
 }
 
@@ -314,7 +472,7 @@ makeliteral_cc(struct buf *b, termchar *c)
 }
 
 static void
-readliteral_chr(struct buf *buf, termchar *c, termline *unused(line))
+readliteral_chr(struct buf *buf, termchar *c, termline *line)
 {
   uchar b = get(buf);
   if (b == 0 || (b >= 0x20 && b < 0x7F))
@@ -329,60 +487,45 @@ readliteral_chr(struct buf *buf, termchar *c, termline *unused(line))
     else
       b = get(buf);
     c->chr = b << 8 | get(buf);
+    mark_bidi(line, c->chr);
+  }
+}
+
+static int
+getattrindex(struct buf *b)
+{
+  uchar byte = get(b);
+  int i = byte & 0x3F;
+  if (byte & 0x40) {
+    int shift = 6;
+    do {
+      byte = get(b);
+      i |= (byte & 0x7F) << shift;
+      shift += 7;
+    } while (byte & 0x80);
   }
+  return i;
 }
 
 static void
 readliteral_attr(struct buf *b, termchar *c, termline *unused(line))
 {
-  cattrflags attr;
-  int link = -1;
-  int imgi = 0;
-  uint fg = 0;
-  uint bg = 0;
-  colour ul = (colour)-1;
+  if (b->data[b->len] & 0x80) {
+    c->attr = attrtab.entries[getattrindex(b)].attr;
+    return;
+  }
 
+  cattrflags attr;
   attr = get(b) << 16;
   attr |= get(b) << 8;
   attr |= get(b);
-  if (attr >= 0x800000) {
-    attr &= ~0x800000;
-    attr <<= 8;
-    attr |= get(b);
-    attr <<= 8;
-    attr |= get(b);
-    attr <<= 8;
-    attr |= get(b);
-    attr <<= 8;
-    attr |= get(b);
-    attr <<= 8;
-    attr |= get(b);
-    link = get(b) << 24;
-    link |= get(b) << 16;
-    link |= get(b) << 8;
-    link |= get(b);
-    imgi = get(b) << 24;
-    imgi |= get(b) << 16;
-    imgi |= get(b) << 8;
-    imgi |= get(b);
-
-    fg = get(b) << 16;
-    fg |= get(b) << 8;
-    fg |= get(b);
-    bg = get(b) << 16;
-    bg |= get(b) << 8;
-    bg |= get(b);
-    ul = get(b) << 16;
-    ul |= get(b) << 8;
-    ul |= get(b);
-  }
 
   c->attr.attr = attr;
-  c->attr.link = link;
-  c->attr.imgi = imgi;
-  c->attr.truefg = fg;
-  c->attr.truebg = bg;
-  c->attr.ulcolr = ul;
+  c->attr.link = -1;
+  c->attr.imgi = 0;
+  c->attr.truefg = 0;
+  c->attr.truebg = 0;
+  c->attr.ulcolr = (colour)-1;
 }
 
 static void
@@ -537,6 +680,8 @@ makerle(struct buf *b, termline *line,
 }
 
 
+static int walkline(uchar *data, int *cols, int refs);
+
 uchar *
 compressline(termline *line)
 {
@@ -586,6 +731,22 @@ compressline(termline *line)
     add(b, (uchar) (n));
   }
 
+ /*
+  * Store the number of columns used up to the last printed character,
+  * so that reflow can tell whether the line needs rewrapping without 
+  * decompressing it.
+  */
+  {
+    int n = line->cols;
+    while (n && attr_clear(line->chars[n - 1].attr.attr))
+      n--;
+    while (n >= 128) {
+      add(b, (uchar) ((n & 0x7F) | 0x80));
+      n >>= 7;
+    }
+    add(b, (uchar) (n));
+  }
+
  /*
   * Now we store a sequence of separate run-length encoded
   * fragments, each containing exactly as many symbols as there
@@ -603,6 +764,11 @@ compressline(termline *line)
   makerle(b, line, makeliteral_attr);
   makerle(b, line, makeliteral_cc);
 
+ /*
+  * Take a reference to interned attributes for each occurrence.
+  */
+  walkline(b->data, null, 1);
+
  /*
   * Trim the allocated memory so we don't waste any, and return.
   */
@@ -657,6 +823,7 @@ decompressline(uchar *data, int *bytes_used)
   termchar * tc = malloc((tl->size + 1) * sizeof(termchar));
   memcpy(tc, data + sizeof(termline), (tl->size + 1) * sizeof(termchar));
   tl->chars = &tc[1];
+  touch_line(tl);
   return tl;
 #endif
 
@@ -684,7 +851,10 @@ decompressline(uchar *data, int *bytes_used)
   newn_1(line->chars, termchar, ncols);
   line->cols = line->size = ncols;
   line->temporary = true;
+  line->refs = 0;
   line->cc_free = 0;
+  line->has_bidi = false;
+  touch_line(line);
 
  /*
   * We must set all the cc pointers in line->chars to 0 right now, 
@@ -718,6 +888,13 @@ decompressline(uchar *data, int *bytes_used)
     line->wrappos = ncols;
   }
 
+ /*
+  * Skip the number of used columns.
+  */
+  do
+    byte = get(b);
+  while (byte & 0x80);
+
  /*
   * Now we read in each of the RLE streams in turn.
   */
@@ -732,6 +909,203 @@ decompressline(uchar *data, int *bytes_used)
   return line;
 }
 
+static void
+skipliteral_chr(struct buf *buf)
+{
+  uchar b = get(buf);
+  if (b == 0 || (b >= 0x20 && b < 0x7F))
+    ;
+  else {
+    if (b == 0x7F)
+      get(buf);
+    get(buf);
+  }
+}
+
+// reference count change to apply to interned attributes while walking
+static int walk_refs = 0;
+
+static void
+skipliteral_attr(struct buf *b)
+{
+  if (b->data[b->len] & 0x80) {
+    int i = getattrindex(b);
+    if (walk_refs)
+      attr_ref(i, walk_refs);
+  }
+  else
+    b->len += 3;
+}
+
+static void
+skipliteral_cc(struct buf *b)
+{
+  while (b->data[b->len]) {
+    skipliteral_chr(b);
+    skipliteral_attr(b);
+  }
+  b->len++;
+}
+
+static void
+skiprle(struct buf *b, int cols, void (*skipliteral) (struct buf *b))
+{
+  //! Note: line->chars is based @ index -1
+  int n = -1;
+
+  while (n < cols) {
+    int hdr = get(b);
+
+    if (hdr >= 0x80) {
+      skipliteral(b);
+      n += hdr + 2 - 0x80;
+    }
+    else {
+      int count = hdr + 1;
+      while (count--)
+        skipliteral(b);
+      n += hdr + 1;
+    }
+  }
+
+  assert(n == cols);
+}
+
+/*
+ * Walk a compressed line without decompressing it, returning its size 
+ * and optionally its columns, and applying a reference count change 
+ * to its interned attributes.
+ */
+static int
+walkline(uchar *data, int *cols, int refs)
+{
+  struct buf buffer, *b = &buffer;
+  int ncols, lattr, byte, shift;
+
+  b->data = data;
+  b->len = 0;
+
+  ncols = shift = 0;
+  do {
+    byte = get(b);
+    ncols |= (byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+
+  lattr = shift = 0;
+  do {
+    byte = get(b);
+    lattr |= (byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+
+  if (lattr & LATTR_WRAPPED)
+    do
+      byte = get(b);
+    while (byte & 0x80);
+
+  do
+    byte = get(b);
+  while (byte & 0x80);
+
+  walk_refs = refs;
+  skiprle(b, ncols, skipliteral_chr);
+  skiprle(b, ncols, skipliteral_attr);
+  skiprle(b, ncols, skipliteral_cc);
+  walk_refs = 0;
+
+  if (cols)
+    *cols = ncols;
+  return b->len;
+}
+
+/*
+ * Determine the size of a compressed line without decompressing it,
+ * for scrollback memory accounting; optionally also return its columns.
+ */
+int
+compressedsize(uchar *data, int *cols)
+{
+#ifdef dont_compress_scrollback_buffer
+  termline * tl = (termline *)data;
+  if (cols)
+    *cols = tl->cols;
+  return sizeof(termline) + (tl->size + 1) * sizeof(termchar);
+#endif
+
+  return walkline(data, cols, 0);
+}
+
+/*
+ * Peek at the header of a compressed line: return its line attributes,
+ * and its columns and the number of columns used up to the last 
+ * printed character (see attr_clear).
+ */
+ushort
+compressedlattr(uchar *data, int *cols, int *used)
+{
+#ifdef dont_compress_scrollback_buffer
+  termline * tl = (termline *)data;
+  termchar * tc = (termchar *)(data + sizeof(termline)) + 1;
+  int n = tl->cols;
+  while (n && attr_clear(tc[n - 1].attr.attr))
+    n--;
+  *cols = tl->cols;
+  *used = n;
+  return tl->lattr;
+#endif
+
+  struct buf buffer, *b = &buffer;
+  int n, lattr, byte, shift;
+
+  b->data = data;
+  b->len = 0;
+
+  n = shift = 0;
+  do {
+    byte = get(b);
+    n |= (byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  *cols = n;
+
+  lattr = shift = 0;
+  do {
+    byte = get(b);
+    lattr |= (byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+
+  if (lattr & LATTR_WRAPPED)
+    do
+      byte = get(b);
+    while (byte & 0x80);
+
+  n = shift = 0;
+  do {
+    byte = get(b);
+    n |= (byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  *used = n;
+
+  return lattr;
+}
+
+/*
+ * Free a compressed line, releasing its interned attributes.
+ */
+void
+freecompressedline(uchar *data)
+{
+  if (!data)
+    return;
+#ifndef dont_compress_scrollback_buffer
+  walkline(data, null, -1);
+#endif
+  free(data);
+}
+
 /*
  * Clear a line, throwing away any combining characters.
  */
@@ -747,6 +1121,8 @@ clearline(termline *line)
     renewn_1(line->chars, line->size);
     line->cc_free = 0;
   }
+  line->has_bidi = false;
+  touch_line(line);
 }
 
 /*
@@ -792,6 +1168,7 @@ resizeline(termline *line, int cols)
     */
     for (int i = oldcols; i < cols; i++)
       line->chars[i] = basic_erase_char;
+    touch_line(line);
   }
 }
 
@@ -804,6 +1181,210 @@ sblines(void)
   return term.on_alt_screen ^ term.show_other_screen ? 0 : term.sblines;
 }
 
+/*
+ * Cache of decompressed scrollback lines.
+ * While the view is scrolled back, painting, searching and selection 
+ * would otherwise decompress the same lines over and over again.
+ * Entries are keyed by absolute line number (see term.sbseq) and 
+ * replaced in least-recently-used order; the scrollback functions in 
+ * term.c drop entries whenever lines leave the scrollback buffer.
+ * Cached lines are owned by the cache; fetch_line and release_line 
+ * count references to them, and a line that is still referenced is 
+ * neither reused nor freed (a dropped one is freed on its last release).
+ * Line attributes changed while painting (bidi direction) are reset 
+ * on the next fetch, as they were lost with temporary lines before.
+ */
+#define SBCACHE_MIN 256
+
+typedef struct {
+  long long int lineno;  // absolute line number, -1 if unused
+  termline * line;
+  ushort lattr;          // line attributes as decompressed
+  long long int gen;
+  int older, newer;      // LRU list links, -1 terminated
+  int hnext;             // hash chain link, -1 terminated
+} sbcache_entry;
+
+static struct {
+  sbcache_entry * entries;
+  int * hash;
+  int size, hsize;
+  int oldest, newest;
+  int used;
+} sbcache;
+
+static inline int
+sbcache_slot(long long int lineno)
+{
+  return (uint)(lineno ^ (lineno >> 17)) & (sbcache.hsize - 1);
+}
+
+static void
+sbcache_unlink(int i)
+{
+  sbcache_entry * e = &sbcache.entries[i];
+  if (e->older >= 0)
+    sbcache.entries[e->older].newer = e->newer;
+  else
+    sbcache.oldest = e->newer;
+  if (e->newer >= 0)
+    sbcache.entries[e->newer].older = e->older;
+  else
+    sbcache.newest = e->older;
+}
+
+static void
+sbcache_link_newest(int i)
+{
+  sbcache_entry * e = &sbcache.entries[i];
+  e->older = sbcache.newest;
+  e->newer = -1;
+  if (sbcache.newest >= 0)
+    sbcache.entries[sbcache.newest].newer = i;
+  else
+    sbcache.oldest = i;
+  sbcache.newest = i;
+}
+
+static void
+sbcache_unhash(int i)
+{
+  int * hp = &sbcache.hash[sbcache_slot(sbcache.entries[i].lineno)];
+  while (*hp != i)
+    hp = &sbcache.entries[*hp].hnext;
+  *hp = sbcache.entries[i].hnext;
+}
+
+/* Free a cached line, or leave it to its last release_line */
+static void
+sbcache_free(termline * line)
+{
+  if (line->refs)
+    line->temporary = true;
+  else
+    freeline(line);
+}
+
+static int
+sbcache_find(long long int lineno)
+{
+  if (!sbcache.used)
+    return -1;
+  int i = sbcache.hash[sbcache_slot(lineno)];
+  while (i >= 0 && sbcache.entries[i].lineno != lineno)
+    i = sbcache.entries[i].hnext;
+  return i;
+}
+
+/*
+ * Drop a line from the cache, if present.
+ */
+void
+sbcache_drop(long long int lineno)
+{
+  int i = sbcache_find(lineno);
+  if (i < 0)
+    return;
+  sbcache_unhash(i);
+  sbcache_unlink(i);
+  sbcache_free(sbcache.entries[i].line);
+  sbcache.entries[i].line = null;
+  sbcache.entries[i].lineno = -1;
+  // keep free entries at the old end for reuse
+  sbcache_entry * e = &sbcache.entries[i];
+  e->older = -1;
+  e->newer = sbcache.oldest;
+  if (sbcache.oldest >= 0)
+    sbcache.entries[sbcache.oldest].older = i;
+  else
+    sbcache.newest = i;
+  sbcache.oldest = i;
+  sbcache.used--;
+}
+
+/*
+ * Drop all lines from the cache, and adapt its capacity to the screen.
+ */
+void
+sbcache_clear(void)
+{
+  for (int i = 0; i < sbcache.size; i++)
+    if (sbcache.entries[i].line)
+      sbcache_free(sbcache.entries[i].line);
+
+  int size = max(SBCACHE_MIN, 2 * term_allrows);
+  if (size != sbcache.size) {
+    sbcache.size = size;
+    sbcache.hsize = 1;
+    while (sbcache.hsize < size)
+      sbcache.hsize <<= 1;
+    sbcache.entries = renewn(sbcache.entries, sbcache.size);
+    sbcache.hash = renewn(sbcache.hash, sbcache.hsize);
+  }
+  for (int i = 0; i < sbcache.hsize; i++)
+    sbcache.hash[i] = -1;
+  for (int i = 0; i < sbcache.size; i++)
+    sbcache.entries[i] = (sbcache_entry)
+                         {.lineno = -1, .line = null, 
+                          .older = i - 1, .newer = i + 1, .hnext = -1};
+  sbcache.entries[sbcache.size - 1].newer = -1;
+  sbcache.oldest = 0;
+  sbcache.newest = sbcache.size - 1;
+  sbcache.used = 0;
+}
+
+static termline *
+sbcache_fetch(long long int lineno, uchar * cline)
+{
+  if (!sbcache.size)
+    sbcache_clear();
+
+  int i = sbcache_find(lineno);
+  if (i >= 0) {
+    // hit: move to the new end of the LRU list
+    if (i != sbcache.newest) {
+      sbcache_unlink(i);
+      sbcache_link_newest(i);
+    }
+    sbcache_entry * e = &sbcache.entries[i];
+    if (!e->line->refs) {
+      // discard changes made while painting
+      e->line->lattr = e->lattr;
+      e->line->gen = e->gen;
+    }
+    e->line->refs++;
+    return e->line;
+  }
+
+  // miss: reuse the least recently used entry that is not referenced
+  i = sbcache.oldest;
+  while (i >= 0 && sbcache.entries[i].line && sbcache.entries[i].line->refs)
+    i = sbcache.entries[i].newer;
+  if (i < 0)
+    // all referenced; fall back to a temporary line
+    return decompressline(cline, null);
+
+  sbcache_entry * e = &sbcache.entries[i];
+  if (e->line) {
+    sbcache_unhash(i);
+    freeline(e->line);
+    sbcache.used--;
+  }
+  e->line = decompressline(cline, null);
+  e->line->temporary = false;  // owned by the cache
+  e->line->refs = 1;
+  e->lattr = e->line->lattr;
+  e->gen = e->line->gen;
+  e->lineno = lineno;
+  int * hp = &sbcache.hash[sbcache_slot(lineno)];
+  e->hnext = *hp;
+  *hp = i;
+  sbcache.used++;
+  sbcache_unlink(i);
+  sbcache_link_newest(i);
+  return e->line;
+}
+
 /*
  * Retrieve a line of the screen or of the scrollback, according to
  * whether the y coordinate is non-negative or negative (respectively).
@@ -820,11 +1401,8 @@ fetch_line(int y)
   }
   else {
     assert(-y <= term.sblines);
-    y += term.sbpos;
-    if (y < 0)
-      y += term.sbsize; // scrollback buffer has wrapped round
-    uchar *cline = term.scrollback[y];
-    line = decompressline(cline, null);
+    uchar *cline = *scrollback_line(term.sblines + y);
+    line = sbcache_fetch(term.sbseq + y, cline);
     resizeline(line, term.cols);
   }
 
@@ -837,6 +1415,8 @@ void
 release_line(termline *line)
 {
   assert(line);
+  if (line->refs && --line->refs)
+    return;
   if (line->temporary)
     freeline(line);
 }
@@ -847,10 +1427,38 @@ release_line(termline *line)
  * too many times, we maintain a cache of the last lineful of data
  * fed to the algorithm on each line of the display.
  */
+/*
+ * Hash the contents of a line as far as termchars_equal compares them,
+ * so that a cached line can be rejected without a full comparison.
+ */
+static unsigned long long
+termchars_hash(termchar *chars, int width)
+{
+#define mix(v)	(h = (h ^ (unsigned long long)(v)) * 0x100000001B3ULL)
+  unsigned long long h = 0xCBF29CE484222325ULL;
+  for (int i = 0; i < width; i++) {
+    termchar *c = chars + i;
+    mix(c->chr);
+    mix(c->attr.attr & ~DATTR_MASK);
+    mix(c->attr.truefg);
+    mix(c->attr.truebg);
+    mix(c->attr.ulcolr);
+    while (c->cc_next) {
+      c += c->cc_next;
+      mix(c->chr);
+    }
+  }
+  return h;
+#undef mix
+}
+
 static int
-term_bidi_cache_hit(int line, termchar *lbefore, ushort lattr, int width)
+term_bidi_cache_hit(int line, termline *tl, int width, 
+                    unsigned long long *hash)
 {
   int i;
+  termchar *lbefore = tl->chars;
+  *hash = 0;  // not computed
 
   if (!term.pre_bidi_cache)
     return false;       /* cache doesn't even exist yet! */
@@ -858,27 +1466,42 @@ term_bidi_cache_hit(int line, termchar *lbefore, ushort lattr, int width)
   if (line >= term.bidi_cache_size)
     return false;       /* cache doesn't have this many lines */
 
-  if (!term.pre_bidi_cache[line].chars)
+  bidi_cache_entry *e = &term.pre_bidi_cache[line];
+
+  if (!e->chars)
     return false;       /* cache doesn't contain _this_ line */
 
-  if (term.pre_bidi_cache[line].lattr != (lattr & LATTR_BIDIMASK))
+  if (e->lattr != (tl->lattr & LATTR_BIDIMASK))
     return false;       /* bidi attributes may be different */
 
-  if (term.pre_bidi_cache[line].width != width)
+  if (e->width != width)
     return false;       /* line is wrong width */
 
+  if (e->line == tl && e->gen == tl->gen)
+    return true;        /* line not modified since it matched */
+
+  *hash = termchars_hash(lbefore, width);
+  if (e->hash != *hash)
+    return false;       /* line doesn't match cache */
+
   for (i = 0; i < width; i++)
-    if (!termchars_equal(term.pre_bidi_cache[line].chars + i, lbefore + i))
+    if (!termchars_equal(e->chars + i, lbefore + i))
       return false;     /* line doesn't match cache */
 
+  e->line = tl;
+  e->gen = tl->gen;
   return true;  /* all termchars matched */
 }
 
 static void
-term_bidi_cache_store(int line, 
-                      termchar *lbefore, termchar *lafter, bidi_char *wcTo, 
-                      ushort lattr, int width, int size, int bidisize)
+term_bidi_cache_store(int line, termline *tl, 
+                      termchar *lafter, bidi_char *wcTo, 
+                      int width, int bidisize, unsigned long long hash)
 {
+  termchar *lbefore = tl->chars;
+  ushort lattr = tl->lattr;
+  int size = tl->size;
+
 #ifdef debug_bidi_cache
   printf("cache_store w %d s %d bs %d\n", width, size, bidisize);
 #endif
@@ -907,6 +1530,9 @@ term_bidi_cache_store(int line,
 
   term.pre_bidi_cache[line].lattr = lattr & LATTR_BIDIMASK;
   term.pre_bidi_cache[line].width = width;
+  term.pre_bidi_cache[line].hash = hash ?: termchars_hash(lbefore, width);
+  term.pre_bidi_cache[line].line = tl;
+  term.pre_bidi_cache[line].gen = tl->gen;
   term.pre_bidi_cache[line].chars = newn(termchar, size);
   term.post_bidi_cache[line].width = width;
   term.post_bidi_cache[line].chars = newn(termchar, size);
@@ -1153,9 +1779,61 @@ term_bidi_line(termline *line, int scr_y)
      )
     return null;
 
+#ifdef support_multiline_bidi
+  // note the autodetected direction of the line and its paragraph
+  void set_autodir(int rtl)
+  {
+    line->lattr |= LATTR_AUTOSEL;
+    if (rtl & 1)
+      line->lattr |= LATTR_AUTORTL;
+    else
+      line->lattr &= ~LATTR_AUTORTL;
+    if (true) {  // limiting to prevseldir does not work
+      ushort parabidi = line->lattr & LATTR_BIDIMASK;
+      //printf("bidi @%d %04X %.22ls rtl %d auto %d lvl %d\n", scr_y, line->lattr, wcsline(line), rtl, autodir, level);
+      termline * paraline = line;
+      bool contd = paraline->lattr & LATTR_WRAPCONTD;
+      int paray = scr_y;
+      while (contd && paray > -sblines()) {
+        paraline = fetch_line(--paray);
+        bool brk = false;
+        if (paraline->lattr & LATTR_WRAPPED) {
+          ushort lattr = (paraline->lattr & ~LATTR_BIDIMASK) | parabidi;
+          if (lattr != paraline->lattr) {
+            paraline->lattr = lattr;
+            touch_line(paraline);
+          }
+          //printf("post @%d %04X %.22ls auto %d lvl %d\n", paray, paraline->lattr, wcsline(paraline), autodir, level);
+#ifdef use_invalidate_useless
+          if (paray >= 0)
+            term_invalidate(0, paray, term.cols, paray);
+#endif
+        }
+        else
+          brk = true;
+        contd = paraline->lattr & LATTR_WRAPCONTD;
+        release_line(paraline);
+        if (brk)
+          break;
+      }
+    }
+  }
+#endif
+
+  // a line without characters that may cause reordering or shaping 
+  // (see mark_bidi) is displayed unchanged in a left-to-right paragraph
+  if (!line->has_bidi && !level && !explicitRTL) {
+#ifdef support_multiline_bidi
+    if (autodir)
+      set_autodir(0);
+#endif
+    return null;
+  }
+
  /* Do Arabic shaping and bidi. */
 
-  if (term_bidi_cache_hit(scr_y, line->chars, line->lattr, term.cols))
+  unsigned long long hash;
+  if (term_bidi_cache_hit(scr_y, line, term.cols, &hash))
     return term.post_bidi_cache[scr_y].chars;
   else {
     if (term.wcFromTo_size < term.cols) {
@@ -1344,38 +2022,8 @@ term_bidi_line(termline *line, int scr_y)
     trace_bidi(":", term.wcFrom, ib);
 
 #ifdef support_multiline_bidi
-    if (autodir && rtl >= 0) {
-      line->lattr |= LATTR_AUTOSEL;
-      if (rtl & 1)
-        line->lattr |= LATTR_AUTORTL;
-      else
-        line->lattr &= ~LATTR_AUTORTL;
-      if (true) {  // limiting to prevseldir does not work
-        ushort parabidi = line->lattr & LATTR_BIDIMASK;
-        //printf("bidi @%d %04X %.22ls rtl %d auto %d lvl %d\n", scr_y, line->lattr, wcsline(line), rtl, autodir, level);
-        termline * paraline = line;
-        bool contd = paraline->lattr & LATTR_WRAPCONTD;
-        int paray = scr_y;
-        while (contd && paray > -sblines()) {
-          paraline = fetch_line(--paray);
-          bool brk = false;
-          if (paraline->lattr & LATTR_WRAPPED) {
-            paraline->lattr = (paraline->lattr & ~LATTR_BIDIMASK) | parabidi;
-            //printf("post @%d %04X %.22ls auto %d lvl %d\n", paray, paraline->lattr, wcsline(paraline), autodir, level);
-#ifdef use_invalidate_useless
-            if (paray >= 0)
-              term_invalidate(0, paray, term.cols, paray);
-#endif
-          }
-          else
-            brk = true;
-          contd = paraline->lattr & LATTR_WRAPCONTD;
-          release_line(paraline);
-          if (brk)
-            break;
-        }
-      }
-    }
+    if (autodir && rtl >= 0)
+      set_autodir(rtl);
 #else
     (void)rtl;
 #endif
@@ -1452,8 +2100,8 @@ term_bidi_line(termline *line, int scr_y)
 
       ib++;
     }
-    term_bidi_cache_store(scr_y, line->chars, term.ltemp, term.wcTo,
-                          line->lattr, term.cols, line->size, ib);
+    term_bidi_cache_store(scr_y, line, term.ltemp, term.wcTo,
+                          term.cols, ib, hash);
 #ifdef debug_bidi_cache
     for (int i = 0; i < term.cols; i++)
       printf(" %04X", term.ltemp[i].chr);
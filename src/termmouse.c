@@ -188,12 +188,12 @@ sel_spread_half(pos p, bool forward)
       p = sel_spread_word(p, forward);
     when MS_SEL_LINE:
       if (forward) {
-        termline *line = fetch_line(p.y);
-        while (line->lattr & LATTR_WRAPPED) {
-          release_line(line);
-          line = fetch_line(++p.y);
+        int y = term_para_last(p.y);
+        if (y != p.y) {
+          p.y = y;
           p.x = 0;
         }
+        termline *line = fetch_line(p.y);
         int x = p.x;
         p.x = term.cols - 1;
         do {
@@ -204,14 +204,7 @@ sel_spread_half(pos p, bool forward)
       }
       else {
         p.x = 0;
-        while (p.y > -sblines()) {
-          termline *line = fetch_line(p.y - 1);
-          bool wrapped = line->lattr & LATTR_WRAPPED;
-          release_line(line);
-          if (!wrapped)
-            break;
-          p.y--;
-        }
+        p.y = term_para_first(p.y);
       }
     otherwise:
      /* Shouldn't happen. */
@@ -98,7 +98,11 @@ term_push_cmd(char c)
 static void
 enable_progress(void)
 {
-  term.lines[term.curs.y]->lattr |= LATTR_PROGRESS;
+  termline * line = term.lines[term.curs.y];
+  if (!(line->lattr & LATTR_PROGRESS)) {
+    line->lattr |= LATTR_PROGRESS;
+    touch_line(line);
+  }
 }
 
 /*
@@ -247,6 +251,8 @@ insert_char(int n)
   m = cols - curs->x - n;
   term_check_boundary(curs->x, curs->y);
   term_check_boundary(curs->x + m, curs->y);
+  term_search_touch(curs->y, curs->y);
+  touch_line(line);
   if (del) {
     for (int j = 0; j < m; j++)
       move_termchar(line, line->chars + curs->x + j,
@@ -314,6 +320,7 @@ attr_rect(cattrflags add, cattrflags sub, cattrflags xor, short y0, short x0, sh
 
   for (int y = y0; y <= y1; y++) {
     termline * l = term.lines[y];
+    touch_line(l);
     int xl = x0;
     int xr = x1;
     if (term.attr_rect < 2) {
@@ -449,8 +456,10 @@ fill_rect(xchar chr, cattr attr, bool sel, short y0, short x0, short y1, short x
   if (width > 1)
     attr.attr |= TATTR_CLEAR | TATTR_NARROW;
 
+  term_search_touch(y0, y1);
   for (int y = y0; y <= y1; y++) {
     termline * l = term.lines[y];
+    touch_line(l);
     bool prevprot = true;  // not false!
     for (int x = x0; x <= x1; x++) {
       //printf("fill %d:%d\n", y, x);
@@ -480,6 +489,7 @@ fill_rect(xchar chr, cattr attr, bool sel, short y0, short x0, short y1, short x
         clear_cc(l, x);
         l->chars[x].chr = chr;
         l->chars[x].attr = attr;
+        mark_bidi(l, chr);
         if (low)
           add_cc(l, x, low, attr);
       }
@@ -527,9 +537,11 @@ copy_rect(short y0, short x0, short y1, short x1, short y2, short x2)
 
   bool down = y2 > y0;
   bool left = x2 > x0;
+  term_search_touch(y2, y2 + y1 - y0);
   for (int y = down ? y1 : y0; down ? y >= y0 : y <= y1; down ? y-- : y++) {
     termline * src = term.lines[y];
     termline * dst = term.lines[y + y2 - y0];
+    touch_line(dst);
     term_check_boundary(x2, y + y2 - y0);
     term_check_boundary(x2 + x1 - x0 + 1, y + y2 - y0);
     for (int x = left ? x1 : x0; left ? x >= x0 : x <= x1; left ? x-- : x++) {
@@ -726,6 +738,7 @@ static void
 wrapparabidi(ushort parabidi, termline * line, int y)
 {
   line->lattr = (line->lattr & ~LATTR_BIDIMASK) | parabidi | LATTR_WRAPCONTD;
+  touch_line(line);
 
 #ifdef determine_parabidi_during_output
   if (parabidi & (LATTR_BIDISEL | LATTR_AUTOSEL))
@@ -739,6 +752,7 @@ wrapparabidi(ushort parabidi, termline * line, int y)
   while ((paraline->lattr & LATTR_WRAPCONTD) && paray > -sblines()) {
     paraline = fetch_line(--paray);
     paraline->lattr = (paraline->lattr & ~LATTR_BIDIMASK) | parabidi;
+    touch_line(paraline);
     release_line(paraline);
   }
   paraline = line;
@@ -746,6 +760,7 @@ wrapparabidi(ushort parabidi, termline * line, int y)
   while ((paraline->lattr & LATTR_WRAPPED) && paray < term.rows) {
     paraline = fetch_line(++paray);
     paraline->lattr = (paraline->lattr & ~LATTR_BIDIMASK) | parabidi;
+    touch_line(paraline);
     release_line(paraline);
   }
 #else
@@ -760,6 +775,7 @@ do_wrap(termline * line, ushort lattr)
 
   line->lattr |= lattr;
   line->wrappos = curs->x;
+  touch_line(line);
   ushort parabidi = getparabidi(line);
   do_linefeed();
   curs->x = term.marg_left;
@@ -815,6 +831,7 @@ write_tab(void)
     (void)do_wrap(line, LATTR_WRAPPED);
   }
 
+  touch_line(term.lines[curs->y]);
   int last = -1;
   do {
     if (curs->x == term.marg_right)
@@ -1008,6 +1025,8 @@ write_char(wchar c, int width)
 
   term_cursor * curs = &term.curs;
   termline * line = term.lines[curs->y];
+  term_search_touch(curs->y, curs->y);
+  touch_line(line);
 
   // support non-BMP for the REP function;
   // this is a hack, it would be cleaner to fold the term_write block
@@ -1033,6 +1052,7 @@ write_char(wchar c, int width)
     clear_cc(line, curs->x);
     line->chars[curs->x].chr = c;
     line->chars[curs->x].attr = curs->attr;
+    mark_bidi(line, c);
 #ifdef insufficient_approach
 #warning this does not help when scrolling via rectangular copy
     if (term.lrmargmode)
@@ -2047,6 +2067,7 @@ do_esc(uchar c)
       move(0, 0, 0);
       cattr savattr = term.curs.attr;
       term.curs.attr = CATTR_DEFAULT;
+      term_search_touch(0, term.rows - 1);
       for (int i = 0; i < term.rows; i++) {
         termline *line = term.lines[i];
         for (int j = 0; j < term.cols; j++) {
@@ -2054,6 +2075,7 @@ do_esc(uchar c)
             (termchar) {.cc_next = 0, .chr = 'E', .attr = CATTR_DEFAULT};
         }
         line->lattr = LATTR_NORM;
+        touch_line(line);
       }
       term.curs.attr = savattr;
       term.disptop = 0;
@@ -2062,19 +2084,23 @@ do_esc(uchar c)
       if (!term.lrmargmode) {
         term.lines[curs->y]->lattr &= LATTR_BIDIMASK;
         term.lines[curs->y]->lattr |= LATTR_TOP;
+        touch_line(term.lines[curs->y]);
       }
     when CPAIR('#', '4'):  /* DECDHL: 2*height, bottom */
       if (!term.lrmargmode) {
         term.lines[curs->y]->lattr &= LATTR_BIDIMASK;
         term.lines[curs->y]->lattr |= LATTR_BOT;
+        touch_line(term.lines[curs->y]);
       }
     when CPAIR('#', '5'):  /* DECSWL: normal */
       term.lines[curs->y]->lattr &= LATTR_BIDIMASK;
       term.lines[curs->y]->lattr |= LATTR_NORM;
+      touch_line(term.lines[curs->y]);
     when CPAIR('#', '6'):  /* DECDWL: 2*width */
       if (!term.lrmargmode) {
         term.lines[curs->y]->lattr &= LATTR_BIDIMASK;
         term.lines[curs->y]->lattr |= LATTR_WIDE;
+        touch_line(term.lines[curs->y]);
       }
     when CPAIR('%', '8') or CPAIR('%', 'G'):
       curs->utf = true;
@@ -2522,9 +2548,11 @@ set_modes(bool state)
         when 69: /* DECLRMM/VT420 DECVSSM: enable left/right margins DECSLRM */
           term.lrmargmode = state;
           if (state) {
+            term_search_touch(0, term.rows - 1);
             for (int i = 0; i < term.rows; i++) {
               termline *line = term.lines[i];
               line->lattr = LATTR_NORM;
+              touch_line(line);
             }
           }
           else {
@@ -2616,6 +2644,7 @@ set_modes(bool state)
             term.lines[term.curs.y]->lattr |= LATTR_MARKED;
           else
             term.lines[term.curs.y]->lattr |= LATTR_UNMARKED;
+          touch_line(term.lines[term.curs.y]);
         when 7727:       /* Application escape key mode */
           term.app_escape_key = state;
         when 7728:       /* Escape sends FS (instead of ESC) */
@@ -2648,6 +2677,7 @@ set_modes(bool state)
             term.lines[term.curs.y]->lattr |= LATTR_NOBIDI;
           else
             term.lines[term.curs.y]->lattr &= ~LATTR_NOBIDI;
+          touch_line(term.lines[term.curs.y]);
         when 77096:      /* Bidi disable */
           term.disable_bidi = state;
         when 8452:       /* Sixel scrolling end position right */
@@ -3260,6 +3290,8 @@ do_csi(uchar c)
         int p = curs->x;
         term_check_boundary(curs->x, curs->y);
         term_check_boundary(curs->x + n, curs->y);
+        term_search_touch(curs->y, curs->y);
+        touch_line(line);
         while (n--) {
           if (!term.iso_guarded_area ||
               !(line->chars[p].attr.attr & ATTR_PROTECTED)
@@ -3605,6 +3637,19 @@ do_csi(uchar c)
           child_printf("\e[?50n");  // 53 was a ctlseqs mistake
         when 56:
           child_printf("\e[?57;1n");
+        when 7712: {  // Scrollback usage report
+          // lines; bytes; compressed size in percent of uncompressed cells
+          long long int raw = term.sbcells * sizeof(termchar);
+          long long int used = term.sbbytes + attrtab_bytes();
+          child_printf("\e[?7712;%d;%lld;%dn", term.sblines, used,
+                       raw ? (int)(used * 100 / raw) : 0);
+        }
+        when 7713: {  // Input queue report
+          // bytes queued for the child process; high-water mark
+          uint peak;
+          uint queued = child_queued(&peak);
+          child_printf("\e[?7713;%u;%un", queued, peak);
+        }
       }
     // DEC Locator
     when CPAIR('\'', 'z'): {  /* DECELR: enable locator reporting */
@@ -3919,6 +3964,7 @@ do_csi(uchar c)
           when 13: attr.truebg = RGB(255, 255, 255);
           otherwise: return;
         }
+        term_search_touch(0, term.rows - 1);
         for (int i = 0; i < term.rows; i++) {
           termline *line = term.lines[i];
           for (int j = 0; j < term.cols; j++) {
@@ -3926,6 +3972,7 @@ do_csi(uchar c)
               (termchar) {.cc_next = 0, .chr = ' ', attr};
           }
           line->lattr = LATTR_NORM;
+          touch_line(line);
         }
         term.disptop = 0;
       }
@@ -6131,8 +6178,7 @@ term_do_write(const char *buf, uint len, bool fix_status)
   }
 
   // Update search match highlighting
-  //term_schedule_search_partial_update();
-  term_schedule_search_update();
+  term_schedule_search_partial_update();
 
   // Update screen
   win_schedule_update();
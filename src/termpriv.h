@@ -63,11 +63,42 @@ extern void move_termchar(termline * line, termchar * dest, termchar * src);
 extern void add_cc(termline *, int col, wchar chr, cattr attr);
 extern void clear_cc(termline *, int col);
 
+// mark cursor position in order not to lose it during reflow
+#define TATTR_MARKCURS (TATTR_ACTCURS | TATTR_PASCURS)
+// determine effective line length trimmed to printed characters;
+// need to include ATTR_BOLD | ATTR_DIM for proper TAB unwrapping
+// need to include TATTR_MARKCURS for proper detection of final cursor
+#define attr_clear(attr) ((attr & (TATTR_CLEAR | ATTR_BOLD | ATTR_DIM | TATTR_MARKCURS)) == TATTR_CLEAR)
+
 extern uchar * compressline(termline *);
 extern termline * decompressline(uchar *, int * bytes_used);
+extern int compressedsize(uchar *, int * cols);
+extern ushort compressedlattr(uchar *, int * cols, int * used);
+extern void freecompressedline(uchar *);
+extern long long int attrtab_bytes(void);
+
+/* Scrollback buffer chunks */
+#define SBCHUNK 4096
+#define sbchunkline(chunks, first, i) \
+        (&(chunks)[((first) + (i)) / SBCHUNK][((first) + (i)) % SBCHUNK])
+
+/* Address of scrollback line i, counting from the oldest line */
+static inline uchar **
+scrollback_line(int i)
+{ return sbchunkline(term.scrollback, term.sbfirst, i); }
+
+/* Cache of decompressed scrollback lines */
+extern void sbcache_drop(long long int lineno);
+extern void sbcache_clear(void);
 
 extern termchar * term_bidi_line(termline *, int scr_y);
 
+/* Regular expressions for searching */
+typedef struct regex regex;
+extern regex * regex_compile(xchar * pattern, int len, uint (*fold)(uint));
+extern void regex_free(regex *);
+extern int regex_search(regex *, xchar * text, int len, int from, bool bol, bool eol, int * end);
+
 extern void term_export_html(bool all, bool do_open);
 extern char * term_get_html(int level);
 extern void print_screen(void);
@@ -0,0 +1,940 @@
+// termregex.c (part of mintty)
+// Licensed under the terms of the GNU General Public License v3 or later.
+
+// Regular expressions for the scrollback search:
+// patterns are parsed into a syntax tree, compiled into a Thompson NFA
+// (forwards and backwards) and run as lazily constructed DFAs,
+// so matching is linear in the length of the searched text.
+//
+// Supported syntax:
+//   .  [...]  [^...]  \d \D \w \W \s \S  \x (literal x)
+//   (...)  |  *  +  ?  {n}  {n,}  {n,m}
+//   ^ at the start and $ at the end of the pattern anchor it
+//   to the start and end of a (wrapped) line
+
+#include "termpriv.h"
+
+
+#define REGEX_MAXREPEAT 1000
+#define REGEX_MAXINSTS 20000
+// bounds on the number and memory of cached DFA states (per DFA);
+// the cache is flushed when full
+#define REGEX_MAXSTATES 2000
+#define REGEX_MAXDFABYTES (4 << 20)
+// bound on the set membership table (sets * character classes)
+#define REGEX_MAXMEMBER (4 << 20)
+
+#define UCS_MAX 0x10FFFF
+
+
+/* Character sets, as sorted lists of disjoint ranges */
+
+typedef struct {
+  xchar lo, hi;
+} rrange;
+
+typedef struct {
+  rrange * ranges;
+  int n;
+} rset;
+
+
+/* Syntax tree */
+
+typedef enum {
+  RN_EMPTY, RN_SET, RN_CAT, RN_ALT, RN_STAR, RN_PLUS, RN_QUEST
+} rntype;
+
+typedef struct rnode {
+  rntype type;
+  int set;
+  struct rnode * a, * b;
+} rnode;
+
+
+/* NFA program */
+
+typedef enum {
+  RI_SET, RI_SPLIT, RI_JMP, RI_MATCH
+} ritype;
+
+typedef struct {
+  ritype op;
+  int x, y;  // jump targets, or character set for RI_SET
+} rinst;
+
+typedef struct {
+  rinst * insts;
+  int n, cap;
+} rprog;
+
+
+/* Lazy DFA */
+
+typedef struct {
+  int * pcs;     // sorted NFA pcs of RI_SET and RI_MATCH instructions
+  int n;
+  bool match;
+  int * next;    // transition per character class; -1 if not computed yet
+  int hnext;     // hash chain
+} rstate;
+
+typedef struct {
+  rprog * prog;
+  bool unanchored;
+  rstate * states;
+  int nstates;
+  int bytes;     // memory of the cached states
+  int * hash;    // REGEX_MAXSTATES * 2 buckets
+  int start;
+} rdfa;
+
+
+struct regex {
+  uint (*fold)(uint);
+  bool bol, eol;
+  rset * sets;
+  int nsets;
+  // character classes: class k covers [bounds[k], bounds[k + 1])
+  xchar * bounds;
+  int nclasses;
+  uchar ascii_class[0x80];
+  uchar * member;  // member[set * nclasses + class]
+  rprog fwd, rev;
+  rdfa fwd_start, rev_start, rev_any;
+  // positions of the current text at which a match starts
+  uchar * starts;
+  int starts_size;
+  // work space for epsilon closures
+  int * stack;
+  uint * mark;
+  uint gen;
+  int * pcs;
+};
+
+
+/* Parser */
+
+typedef struct {
+  regex * rx;
+  xchar * p, * end;
+  int nodes;
+  bool error;
+} rparser;
+
+static rnode *
+mknode(rparser * ps, rntype type, rnode * a, rnode * b)
+{
+  rnode * n = new(rnode);
+  n->type = type;
+  n->set = -1;
+  n->a = a;
+  n->b = b;
+  ps->nodes++;
+  return n;
+}
+
+static void
+freenode(rnode * n)
+{
+  if (n) {
+    freenode(n->a);
+    freenode(n->b);
+    free(n);
+  }
+}
+
+static int
+nodecount(rnode * n)
+{
+  return n ? 1 + nodecount(n->a) + nodecount(n->b) : 0;
+}
+
+static rnode *
+clonenode(rparser * ps, rnode * n)
+{
+  if (!n)
+    return 0;
+  rnode * c = mknode(ps, n->type, clonenode(ps, n->a), clonenode(ps, n->b));
+  c->set = n->set;
+  return c;
+}
+
+static void
+set_add(rset * s, xchar lo, xchar hi)
+{
+  s->ranges = renewn(s->ranges, s->n + 1);
+  s->ranges[s->n++] = (rrange){lo, hi};
+}
+
+static int
+cmp_range(const void * a, const void * b)
+{
+  const rrange * r1 = a, * r2 = b;
+  return r1->lo < r2->lo ? -1 : r1->lo > r2->lo;
+}
+
+// Sort and merge the ranges of a set, optionally complementing it
+static void
+set_normalize(rset * s, bool negate)
+{
+  qsort(s->ranges, s->n, sizeof(rrange), cmp_range);
+  int n = 0;
+  for (int i = 0; i < s->n; i++) {
+    if (n && s->ranges[i].lo <= s->ranges[n - 1].hi + 1) {
+      if (s->ranges[i].hi > s->ranges[n - 1].hi)
+        s->ranges[n - 1].hi = s->ranges[i].hi;
+    }
+    else
+      s->ranges[n++] = s->ranges[i];
+  }
+  s->n = n;
+
+  if (negate) {
+    rrange * ranges = s->ranges;
+    s->ranges = 0;
+    s->n = 0;
+    xchar lo = 0;
+    for (int i = 0; i < n; i++) {
+      if (ranges[i].lo > lo)
+        set_add(s, lo, ranges[i].lo - 1);
+      lo = ranges[i].hi + 1;
+    }
+    if (lo <= UCS_MAX)
+      set_add(s, lo, UCS_MAX);
+    free(ranges);
+  }
+}
+
+// Add a range to a set, matching case-folded text
+static void
+set_add_folded(regex * rx, rset * s, xchar lo, xchar hi)
+{
+  if (hi - lo < 0x100)
+    for (xchar c = lo; c <= hi; c++) {
+      xchar f = rx->fold(c);
+      set_add(s, f, f);
+    }
+  else
+    set_add(s, lo, hi);
+}
+
+static int
+newset(regex * rx)
+{
+  rx->sets = renewn(rx->sets, rx->nsets + 1);
+  rx->sets[rx->nsets] = (rset){0, 0};
+  return rx->nsets++;
+}
+
+static rnode *
+setnode(rparser * ps, int set)
+{
+  rnode * n = mknode(ps, RN_SET, 0, 0);
+  n->set = set;
+  return n;
+}
+
+// Add the ranges of a class escape (\d \w \s); return false if c is none
+static bool
+class_escape(rset * s, xchar c)
+{
+  switch (c) {
+    when 'd' or 'D':
+      set_add(s, '0', '9');
+    when 'w' or 'W':
+      set_add(s, '0', '9');
+      set_add(s, 'A', 'Z');
+      set_add(s, '_', '_');
+      set_add(s, 'a', 'z');
+      set_add(s, 0xC0, 0x24F);
+    when 's' or 'S':
+      set_add(s, '\t', '\r');
+      set_add(s, ' ', ' ');
+      set_add(s, 0xA0, 0xA0);
+      set_add(s, 0x3000, 0x3000);
+    otherwise:
+      return false;
+  }
+  return true;
+}
+
+static xchar
+escaped_char(xchar c)
+{
+  switch (c) {
+    when 't': return '\t';
+    when 'n': return '\n';
+    when 'r': return '\r';
+  }
+  return c;
+}
+
+static rnode * parse_alt(rparser * ps);
+
+static rnode *
+parse_class(rparser * ps)
+{
+  regex * rx = ps->rx;
+  int set = newset(rx);
+  bool negate = false;
+  if (ps->p < ps->end && *ps->p == '^') {
+    negate = true;
+    ps->p++;
+  }
+  bool first = true;
+  while (ps->p < ps->end && (*ps->p != ']' || first)) {
+    first = false;
+    xchar lo = *ps->p++;
+    if (lo == '\\' && ps->p < ps->end) {
+      xchar c = *ps->p++;
+      rset cls = {0, 0};
+      if (class_escape(&cls, c)) {
+        set_normalize(&cls, c >= 'A' && c <= 'Z');
+        for (int i = 0; i < cls.n; i++)
+          set_add(&rx->sets[set], cls.ranges[i].lo, cls.ranges[i].hi);
+        free(cls.ranges);
+        continue;
+      }
+      lo = escaped_char(c);
+    }
+    xchar hi = lo;
+    if (ps->p + 1 < ps->end && ps->p[0] == '-' && ps->p[1] != ']') {
+      hi = ps->p[1];
+      ps->p += 2;
+      if (hi == '\\' && ps->p < ps->end)
+        hi = escaped_char(*ps->p++);
+      if (hi < lo) {
+        ps->error = true;
+        return 0;
+      }
+    }
+    set_add_folded(rx, &rx->sets[set], lo, hi);
+  }
+  if (ps->p >= ps->end) {
+    ps->error = true;
+    return 0;
+  }
+  ps->p++;  // ']'
+  set_normalize(&rx->sets[set], negate);
+  return setnode(ps, set);
+}
+
+static rnode *
+parse_atom(rparser * ps)
+{
+  regex * rx = ps->rx;
+  xchar c = *ps->p++;
+  switch (c) {
+    when '(': {
+      rnode * n = parse_alt(ps);
+      if (ps->error || ps->p >= ps->end || *ps->p != ')') {
+        freenode(n);
+        ps->error = true;
+        return 0;
+      }
+      ps->p++;
+      return n ?: mknode(ps, RN_EMPTY, 0, 0);
+    }
+    when '[':
+      return parse_class(ps);
+    when '.': {
+      int set = newset(rx);
+      set_add(&rx->sets[set], 0, UCS_MAX);
+      return setnode(ps, set);
+    }
+    when '*' or '+' or '?' or ')':
+      ps->error = true;
+      return 0;
+    when '\\':
+      if (ps->p >= ps->end) {
+        ps->error = true;
+        return 0;
+      }
+      c = *ps->p++;
+      int set = newset(rx);
+      if (class_escape(&rx->sets[set], c)) {
+        set_normalize(&rx->sets[set], c >= 'A' && c <= 'Z');
+        return setnode(ps, set);
+      }
+      c = escaped_char(c);
+      set_add_folded(rx, &rx->sets[set], c, c);
+      return setnode(ps, set);
+  }
+  int set = newset(rx);
+  set_add_folded(rx, &rx->sets[set], c, c);
+  return setnode(ps, set);
+}
+
+// Parse a repetition count; false if there is none, or if it is too large
+// (which is an error)
+static bool
+parse_number(rparser * ps, int * n)
+{
+  if (ps->p >= ps->end || *ps->p < '0' || *ps->p > '9')
+    return false;
+  *n = 0;
+  while (ps->p < ps->end && *ps->p >= '0' && *ps->p <= '9') {
+    *n = *n * 10 + *ps->p++ - '0';
+    if (*n > REGEX_MAXREPEAT) {
+      ps->error = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Expand a{min,max} (max < 0: unbounded) into basic operators
+static rnode *
+repeat(rparser * ps, rnode * a, int min, int max)
+{
+  rnode * res = 0;
+  for (int i = 0; i < min; i++) {
+    rnode * c = i ? clonenode(ps, a) : a;
+    res = res ? mknode(ps, RN_CAT, res, c) : c;
+  }
+  if (max < 0) {
+    rnode * star = mknode(ps, RN_STAR, min ? clonenode(ps, a) : a, 0);
+    return res ? mknode(ps, RN_CAT, res, star) : star;
+  }
+  // a{0,k} = (a(a(a)?)?)?
+  rnode * opt = 0;
+  for (int i = min; i < max; i++) {
+    rnode * c = (i || min) ? clonenode(ps, a) : a;
+    opt = mknode(ps, RN_QUEST, opt ? mknode(ps, RN_CAT, c, opt) : c, 0);
+  }
+  if (!min && !max)
+    freenode(a);
+  if (opt)
+    res = res ? mknode(ps, RN_CAT, res, opt) : opt;
+  return res ?: mknode(ps, RN_EMPTY, 0, 0);
+}
+
+static rnode *
+parse_repeat(rparser * ps)
+{
+  rnode * n = parse_atom(ps);
+  while (!ps->error && ps->p < ps->end) {
+    xchar c = *ps->p;
+    if (c == '*' || c == '+' || c == '?') {
+      ps->p++;
+      n = mknode(ps, c == '*' ? RN_STAR : c == '+' ? RN_PLUS : RN_QUEST, n, 0);
+    }
+    else if (c == '{') {
+      xchar * save = ps->p++;
+      int min, max;
+      if (!parse_number(ps, &min)) {
+        if (ps->error)
+          break;
+        // not a repetition; take '{' literally
+        ps->p = save;
+        break;
+      }
+      max = min;
+      if (ps->p < ps->end && *ps->p == ',') {
+        ps->p++;
+        if (!parse_number(ps, &max)) {
+          if (ps->error)
+            break;
+          max = -1;
+        }
+      }
+      if (ps->p >= ps->end || *ps->p != '}' || (max >= 0 && max < min)) {
+        ps->error = true;
+        break;
+      }
+      ps->p++;
+      // check the size of the expansion before building it
+      int reps = (max > min ? max : min) + 1;
+      if (ps->nodes + (long long)nodecount(n) * reps * 2 > REGEX_MAXINSTS) {
+        ps->error = true;
+        break;
+      }
+      n = repeat(ps, n, min, max);
+    }
+    else
+      break;
+    // a lazy '?' suffix makes no difference for our longest matches
+    if (ps->p < ps->end && *ps->p == '?' && c != '?')
+      ps->p++;
+    if (ps->nodes > REGEX_MAXINSTS)
+      ps->error = true;
+  }
+  return n;
+}
+
+static rnode *
+parse_cat(rparser * ps)
+{
+  rnode * n = 0;
+  while (!ps->error && ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+    rnode * a = parse_repeat(ps);
+    n = n ? mknode(ps, RN_CAT, n, a) : a;
+  }
+  return n ?: mknode(ps, RN_EMPTY, 0, 0);
+}
+
+static rnode *
+parse_alt(rparser * ps)
+{
+  rnode * n = parse_cat(ps);
+  while (!ps->error && ps->p < ps->end && *ps->p == '|') {
+    ps->p++;
+    n = mknode(ps, RN_ALT, n, parse_cat(ps));
+  }
+  return n;
+}
+
+
+/* Compiler */
+
+static int
+emit(rprog * prog, ritype op, int x, int y)
+{
+  if (prog->n == prog->cap) {
+    prog->cap = prog->cap ? prog->cap * 2 : 64;
+    prog->insts = renewn(prog->insts, prog->cap);
+  }
+  prog->insts[prog->n] = (rinst){op, x, y};
+  return prog->n++;
+}
+
+static void
+compile(rprog * prog, rnode * n, bool reverse)
+{
+  switch (n->type) {
+    when RN_EMPTY:
+      ;
+    when RN_SET:
+      emit(prog, RI_SET, n->set, 0);
+    when RN_CAT:
+      compile(prog, reverse ? n->b : n->a, reverse);
+      compile(prog, reverse ? n->a : n->b, reverse);
+    when RN_ALT: {
+      int split = emit(prog, RI_SPLIT, 0, 0);
+      prog->insts[split].x = prog->n;
+      compile(prog, n->a, reverse);
+      int jmp = emit(prog, RI_JMP, 0, 0);
+      prog->insts[split].y = prog->n;
+      compile(prog, n->b, reverse);
+      prog->insts[jmp].x = prog->n;
+    }
+    when RN_STAR: {
+      int split = emit(prog, RI_SPLIT, 0, 0);
+      prog->insts[split].x = prog->n;
+      compile(prog, n->a, reverse);
+      emit(prog, RI_JMP, split, 0);
+      prog->insts[split].y = prog->n;
+    }
+    when RN_PLUS: {
+      int loop = prog->n;
+      compile(prog, n->a, reverse);
+      emit(prog, RI_SPLIT, loop, prog->n + 1);
+    }
+    when RN_QUEST: {
+      int split = emit(prog, RI_SPLIT, 0, 0);
+      prog->insts[split].x = prog->n;
+      compile(prog, n->a, reverse);
+      prog->insts[split].y = prog->n;
+    }
+  }
+}
+
+static int
+cmp_xchar(const void * a, const void * b)
+{
+  xchar c1 = *(const xchar *)a, c2 = *(const xchar *)b;
+  return c1 < c2 ? -1 : c1 > c2;
+}
+
+// Partition the character space into classes that no set distinguishes;
+// false if the membership table would be too large
+static bool
+make_classes(regex * rx)
+{
+  int nb = 1;
+  for (int i = 0; i < rx->nsets; i++)
+    nb += rx->sets[i].n * 2;
+  xchar * b = newn(xchar, nb);
+  int n = 0;
+  b[n++] = 0;
+  for (int i = 0; i < rx->nsets; i++)
+    for (int j = 0; j < rx->sets[i].n; j++) {
+      b[n++] = rx->sets[i].ranges[j].lo;
+      if (rx->sets[i].ranges[j].hi < UCS_MAX)
+        b[n++] = rx->sets[i].ranges[j].hi + 1;
+    }
+  qsort(b, n, sizeof(xchar), cmp_xchar);
+  int k = 0;
+  for (int i = 0; i < n; i++)
+    if (!k || b[i] != b[k - 1])
+      b[k++] = b[i];
+  rx->bounds = b;
+  rx->nclasses = k;
+
+  if ((long long)rx->nsets * k > REGEX_MAXMEMBER)
+    return false;
+  rx->member = newn(uchar, rx->nsets * k + 1);
+  for (int i = 0; i < rx->nsets; i++)
+    for (int j = 0; j < rx->sets[i].n; j++)
+      for (int c = 0; c < k; c++)
+        if (b[c] >= rx->sets[i].ranges[j].lo && b[c] <= rx->sets[i].ranges[j].hi)
+          rx->member[i * k + c] = 1;
+  return true;
+}
+
+static int
+char_class(regex * rx, xchar c)
+{
+  int lo = 0, hi = rx->nclasses - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (rx->bounds[mid] <= c)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+
+/* Lazy DFA */
+
+static void
+dfa_init(rdfa * dfa, rprog * prog, bool unanchored)
+{
+  dfa->prog = prog;
+  dfa->unanchored = unanchored;
+  dfa->states = 0;
+  dfa->nstates = 0;
+  dfa->bytes = 0;
+  dfa->hash = newn(int, REGEX_MAXSTATES * 2);
+  for (int i = 0; i < REGEX_MAXSTATES * 2; i++)
+    dfa->hash[i] = -1;
+  dfa->start = -1;
+}
+
+static void
+dfa_flush(rdfa * dfa)
+{
+  for (int i = 0; i < dfa->nstates; i++) {
+    free(dfa->states[i].pcs);
+    free(dfa->states[i].next);
+  }
+  free(dfa->states);
+  dfa->states = 0;
+  dfa->nstates = 0;
+  dfa->bytes = 0;
+  for (int i = 0; i < REGEX_MAXSTATES * 2; i++)
+    dfa->hash[i] = -1;
+  dfa->start = -1;
+}
+
+static void
+dfa_free(rdfa * dfa)
+{
+  if (dfa->hash) {
+    dfa_flush(dfa);
+    free(dfa->hash);
+  }
+}
+
+// Add the epsilon closure of pc to rx->pcs[*n]
+static void
+closure(regex * rx, rprog * prog, int pc, int * n)
+{
+  int sp = 0;
+  rx->stack[sp++] = pc;
+  while (sp) {
+    pc = rx->stack[--sp];
+    if (rx->mark[pc] == rx->gen)
+      continue;
+    rx->mark[pc] = rx->gen;
+    rinst * in = &prog->insts[pc];
+    switch (in->op) {
+      when RI_JMP:
+        rx->stack[sp++] = in->x;
+      when RI_SPLIT:
+        // push y first so that x is explored first
+        rx->stack[sp++] = in->y;
+        rx->stack[sp++] = in->x;
+      otherwise:
+        rx->pcs[(*n)++] = pc;
+    }
+  }
+}
+
+static int
+cmp_int(const void * a, const void * b)
+{
+  int i1 = *(const int *)a, i2 = *(const int *)b;
+  return i1 < i2 ? -1 : i1 > i2;
+}
+
+// Find or add the state for the set rx->pcs[0..n); -1 if the cache is full
+static int
+dfa_state(regex * rx, rdfa * dfa, int n)
+{
+  qsort(rx->pcs, n, sizeof(int), cmp_int);
+  uint h = n;
+  for (int i = 0; i < n; i++)
+    h = h * 31 + rx->pcs[i];
+  h %= REGEX_MAXSTATES * 2;
+  for (int s = dfa->hash[h]; s >= 0; s = dfa->states[s].hnext)
+    if (dfa->states[s].n == n && !memcmp(dfa->states[s].pcs, rx->pcs, n * sizeof(int)))
+      return s;
+
+  int bytes = (n + 1 + rx->nclasses) * sizeof(int);
+  if (dfa->nstates == REGEX_MAXSTATES || dfa->bytes + bytes > REGEX_MAXDFABYTES)
+    return -1;
+  if (!dfa->states)
+    dfa->states = newn(rstate, REGEX_MAXSTATES);
+  dfa->bytes += bytes;
+  rstate * st = &dfa->states[dfa->nstates];
+  st->n = n;
+  st->pcs = newn(int, n + 1);
+  memcpy(st->pcs, rx->pcs, n * sizeof(int));
+  st->match = false;
+  for (int i = 0; i < n; i++)
+    if (dfa->prog->insts[rx->pcs[i]].op == RI_MATCH)
+      st->match = true;
+  st->next = newn(int, rx->nclasses);
+  for (int i = 0; i < rx->nclasses; i++)
+    st->next[i] = -1;
+  st->hnext = dfa->hash[h];
+  dfa->hash[h] = dfa->nstates;
+  return dfa->nstates++;
+}
+
+static int
+dfa_start(regex * rx, rdfa * dfa)
+{
+  if (dfa->start < 0) {
+    int n = 0;
+    rx->gen++;
+    closure(rx, dfa->prog, 0, &n);
+    dfa->start = dfa_state(rx, dfa, n);
+    if (dfa->start < 0) {
+      dfa_flush(dfa);
+      dfa->start = dfa_state(rx, dfa, n);
+    }
+  }
+  return dfa->start;
+}
+
+static int
+dfa_step(regex * rx, rdfa * dfa, int s, xchar c)
+{
+  int cls = c < 0x80 ? rx->ascii_class[c] : char_class(rx, c);
+  int next = dfa->states[s].next[cls];
+  if (next >= 0)
+    return next;
+
+  int n = 0;
+  rx->gen++;
+  rstate * st = &dfa->states[s];
+  for (int i = 0; i < st->n; i++) {
+    rinst * in = &dfa->prog->insts[st->pcs[i]];
+    if (in->op == RI_SET && rx->member[in->x * rx->nclasses + cls])
+      closure(rx, dfa->prog, st->pcs[i] + 1, &n);
+  }
+  if (dfa->unanchored)
+    closure(rx, dfa->prog, 0, &n);
+
+  next = dfa_state(rx, dfa, n);
+  if (next < 0) {
+    // Cache full: start over with only the state we are moving to
+    int * pcs = newn(int, n + 1);
+    memcpy(pcs, rx->pcs, n * sizeof(int));
+    dfa_flush(dfa);
+    memcpy(rx->pcs, pcs, n * sizeof(int));
+    free(pcs);
+    return dfa_state(rx, dfa, n);
+  }
+  dfa->states[s].next[cls] = next;
+  return next;
+}
+
+static inline bool
+dfa_dead(rdfa * dfa, int s)
+{
+  return !dfa->states[s].n;
+}
+
+
+/* Interface */
+
+void
+regex_free(regex * rx)
+{
+  if (!rx)
+    return;
+  for (int i = 0; i < rx->nsets; i++)
+    free(rx->sets[i].ranges);
+  free(rx->sets);
+  free(rx->bounds);
+  free(rx->member);
+  free(rx->fwd.insts);
+  free(rx->rev.insts);
+  dfa_free(&rx->fwd_start);
+  dfa_free(&rx->rev_start);
+  dfa_free(&rx->rev_any);
+  free(rx->starts);
+  free(rx->stack);
+  free(rx->mark);
+  free(rx->pcs);
+  free(rx);
+}
+
+/*
+   Compile a pattern of len characters; literal characters are
+   matched against text converted with fold.
+   Return null if the pattern is invalid.
+ */
+regex *
+regex_compile(xchar * pattern, int len, uint (*fold)(uint))
+{
+  regex * rx = newn(regex, 1);
+  rx->fold = fold;
+  if (len && pattern[0] == '^') {
+    rx->bol = true;
+    pattern++;
+    len--;
+  }
+  if (len && pattern[len - 1] == '$' && (len < 2 || pattern[len - 2] != '\\')) {
+    rx->eol = true;
+    len--;
+  }
+
+  rparser ps = {.rx = rx, .p = pattern, .end = pattern + len};
+  rnode * tree = parse_alt(&ps);
+  if (ps.error || ps.p < ps.end) {
+    freenode(tree);
+    regex_free(rx);
+    return 0;
+  }
+
+  compile(&rx->fwd, tree, false);
+  emit(&rx->fwd, RI_MATCH, 0, 0);
+  compile(&rx->rev, tree, true);
+  emit(&rx->rev, RI_MATCH, 0, 0);
+  freenode(tree);
+  if (rx->fwd.n > REGEX_MAXINSTS) {
+    regex_free(rx);
+    return 0;
+  }
+
+  if (!make_classes(rx)
+      // a flushed DFA cache must still take a good number of states
+      || (rx->nclasses + rx->fwd.n + 1) * sizeof(int) * 16 > REGEX_MAXDFABYTES
+     ) {
+    regex_free(rx);
+    return 0;
+  }
+  // ASCII characters fall into the first 0x80 classes, as bounds are distinct
+  for (xchar c = 0; c < 0x80; c++)
+    rx->ascii_class[c] = char_class(rx, c);
+
+  rx->stack = newn(int, rx->fwd.n * 2 + 1);
+  rx->mark = newn(uint, rx->fwd.n + 1);
+  rx->pcs = newn(int, rx->fwd.n + 1);
+  dfa_init(&rx->fwd_start, &rx->fwd, false);
+  dfa_init(&rx->rev_start, &rx->rev, false);
+  dfa_init(&rx->rev_any, &rx->rev, true);
+  return rx;
+}
+
+// End of the longest match starting at i, or -1
+static int
+longest_fwd(regex * rx, xchar * text, int i, int len)
+{
+  rdfa * dfa = &rx->fwd_start;
+  int s = dfa_start(rx, dfa);
+  int last = dfa->states[s].match ? i : -1;
+  for (int j = i; j < len; j++) {
+    s = dfa_step(rx, dfa, s, text[j]);
+    if (dfa_dead(dfa, s))
+      break;
+    if (dfa->states[s].match)
+      last = j + 1;
+  }
+  return last;
+}
+
+// Start of the longest match ending at e and starting at or after from, or -1
+static int
+longest_rev(regex * rx, xchar * text, int from, int e)
+{
+  rdfa * dfa = &rx->rev_start;
+  int s = dfa_start(rx, dfa);
+  int last = dfa->states[s].match ? e : -1;
+  for (int j = e - 1; j >= from; j--) {
+    s = dfa_step(rx, dfa, s, text[j]);
+    if (dfa_dead(dfa, s))
+      break;
+    if (dfa->states[s].match)
+      last = j;
+  }
+  return last;
+}
+
+/*
+   Find the leftmost-longest non-empty match in text[from..len).
+   bol/eol tell whether the text starts/ends at a line boundary,
+   for anchored patterns.
+   Successive calls for the same text must pass increasing values of from, 
+   starting with 0.
+   Return the match start and set *end, or return -1.
+ */
+int
+regex_search(regex * rx, xchar * text, int len, int from, bool bol, bool eol, int * end)
+{
+  if (rx->bol) {
+    if (!bol || from > 0)
+      return -1;
+    int e = longest_fwd(rx, text, 0, len);
+    if (rx->eol) {
+      // the match must cover the whole text
+      if (!eol || e != len)
+        return -1;
+    }
+    if (e <= 0)
+      return -1;
+    *end = e;
+    return 0;
+  }
+  if (rx->eol) {
+    if (!eol || from > 0)
+      return -1;
+    int s = longest_rev(rx, text, 0, len);
+    if (s < 0 || s == len)
+      return -1;
+    *end = len;
+    return s;
+  }
+
+  if (from == 0) {
+    // One backward pass over the text finds all positions where a match 
+    // starts, as that only depends on the text following them
+    if (len > rx->starts_size) {
+      rx->starts_size = len;
+      rx->starts = renewn(rx->starts, len);
+    }
+    rdfa * dfa = &rx->rev_any;
+    int s = dfa_start(rx, dfa);
+    for (int j = len - 1; j >= 0; j--) {
+      s = dfa_step(rx, dfa, s, text[j]);
+      rx->starts[j] = dfa->states[s].match;
+    }
+  }
+
+  for (; from < len; from++)
+    if (rx->starts[from]) {
+      int e = longest_fwd(rx, text, from, len);
+      if (e > from) {
+        *end = e;
+        return from;
+      }
+    }
+  return -1;
+}
@@ -27,6 +27,7 @@ extern void win_schedule_update(void);
 extern void do_update(void);
 
 extern void win_text(int x, int y, wchar *text, int len, cattr attr, cattr *textattr, ushort lattr, char has_rtl, char has_sea, bool clearpad, uchar phase);
+extern void win_paint_cmds(void);
 
 /* input */
 extern void win_update_mouse(void);
@@ -672,17 +672,6 @@ winimgs_paint(void)
 {
   imglist * img;
 
-  /* mitigate a glitch in the suppression of repetitive image painting:
-     when selection highlighting is cancelled, images need to be repainted;
-     rather than setting a token whenever that happens, we remember the 
-     previous selection state here and force repainting if it changed
-  */
-static bool previously_selected = false;
-  if (term.selected != previously_selected) {
-    force_imgs = true;
-    previously_selected = term.selected;
-  }
-
   /* free disk space if number of tempfile exceeds TEMPFILE_MAX_NUM */
   while (tempfile_num > TEMPFILE_MAX_NUM && term.imgs.first) {
     img = term.imgs.first;
@@ -747,8 +736,10 @@ static bool previously_selected = false;
       // line-wrapping on images?
       // see disabled setting of term.virtuallines in term_reflow()
 
-      // suppress repetitive image painting
-      if (left == img->x && top == img->y && !force_imgs)
+      // suppress repetitive image painting, unless cells of the image 
+      // have been painted over (e.g. selection highlighting or cursor)
+      if (left == img->x && top == img->y && !force_imgs
+          && !term_damaged(top, left, top + img->height - 1, left + img->width - 1))
         continue;
       img->x = left;
       img->y = top;
@@ -2833,6 +2833,8 @@ C	M	+C	+A	"	"
   if (selection_pending) {
     bool sel_adjust = false;
     //WPARAM scroll = 0;
+    // keyboard selection may move through the whole scrollback
+    term_rewrap_pending();
     int sbtop = -sblines();
     int sbbot = term_last_nonempty_line();
     int oldisptop = term.disptop;
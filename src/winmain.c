@@ -5224,7 +5224,7 @@ static struct {
 
     when WM_PAINT:
       //printsb("WS_PAINT");
-      force_imgs = true;  // override suppression of repetitive image painting
+      // images in the exposed area are repainted by way of display damage
       win_paint();
 
 #ifdef handle_default_size_asynchronously
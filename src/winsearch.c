@@ -13,6 +13,8 @@ static HWND search_close_wnd;
 static HWND search_prev_wnd;
 static HWND search_next_wnd;
 static HWND search_edit_wnd;
+static HWND search_count_wnd;
+static HWND search_regex_wnd;
 static WNDPROC default_edit_proc;
 static HFONT search_font = 0;
 
@@ -30,7 +32,7 @@ current_delta(bool adjust)
     return 0;
   }
 
-  int y = term.results.current.idx / term.cols - term.sblines;
+  int y = term.results.current.idx / term.cols - term.sbseq;
   int delta = 0;
   if (y < term.disptop) {
     delta = y - term.disptop;
@@ -145,6 +147,14 @@ search_proc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp)
     when WM_COMMAND:
       switch (HIWORD(wp)) {
         when BN_CLICKED: // Equivalent to STN_CLICKED
+          if (lp == (long)search_regex_wnd) {
+            // Toggle regular expression mode and search again
+            term.results.regex_mode =
+              SendMessage(search_regex_wnd, BM_GETCHECK, 0, 0) == BST_CHECKED;
+            SetFocus(search_edit_wnd);
+            update = true;
+            break;
+          }
           if (lp == (long)search_prev_wnd) {
             prev_result();
           }
@@ -216,7 +226,8 @@ win_toggle_search(bool show, bool focus)
   int button_width = cell_width * 2;
   SEARCHBAR_HEIGHT = height;
 
-  int edit_width = width - button_width * 3 - margin * 2;
+  int count_width = cell_width * 8;
+  int edit_width = width - button_width * 4 - count_width - margin * 2;
   int ctrl_height = height - margin * 2;
   int sf_height = ctrl_height - 4;
 #ifdef debug_searchbar
@@ -228,6 +239,8 @@ win_toggle_search(bool show, bool focus)
   int pos_prev = -1;
   int pos_next = -1;
   int pos_edit = -1;
+  int pos_count = -1;
+  int pos_regex = -1;
   int barpos = margin;
   wchar * prev_but = _W("◀");
   wchar * next_but = _W("▶");
@@ -242,6 +255,8 @@ win_toggle_search(bool show, bool focus)
         place_field(& barpos, button_width, & pos_next);
       when 's' or 'S':
         place_field(& barpos, edit_width, & pos_edit);
+      when 'r' or 'R':
+        place_field(& barpos, button_width, & pos_regex);
       when 0x25B2 ... 0x25B5 or 0x25C0 ... 0x25C5:
         place_field(& barpos, button_width, & pos_prev);
         * prev_but = * search_bar;
@@ -286,6 +301,8 @@ win_toggle_search(bool show, bool focus)
   place_field(& barpos, button_width, & pos_prev);
   place_field(& barpos, button_width, & pos_next);
   place_field(& barpos, edit_width, & pos_edit);
+  place_field(& barpos, button_width, & pos_regex);
+  place_field(& barpos, count_width, & pos_count);
 
   // Set up our global variables.
   if (!search_initialised || height != prev_height) {
@@ -323,6 +340,15 @@ win_toggle_search(bool show, bool focus)
     search_edit_wnd = CreateWindowExA(WS_EX_CLIENTEDGE, "EDIT", "", WS_CHILD | WS_VISIBLE | WS_TABSTOP | ES_AUTOHSCROLL,
                                      0, 0, 0, 0,
                                      search_wnd, NULL, inst, NULL);
+    search_count_wnd = CreateWindowExA(0, "STATIC", "", WS_CHILD | WS_VISIBLE | SS_CENTER | SS_CENTERIMAGE,
+                                     0, 0, 0, 0,
+                                     search_wnd, NULL, inst, NULL);
+    //__ label of search bar regular expression toggle; not actually "localization"
+    search_regex_wnd = CreateWindowExW(0, W("BUTTON"), W(".*"), WS_CHILD | WS_VISIBLE | BS_AUTOCHECKBOX | BS_PUSHLIKE,
+                                     pos_regex, margin, button_width, ctrl_height,
+                                     search_wnd, NULL, inst, NULL);
+    SendMessage(search_regex_wnd, BM_SETCHECK,
+                term.results.regex_mode ? BST_CHECKED : BST_UNCHECKED, 0);
 
 #ifdef darken_searchbar
     win_dark_mode(search_prev_wnd);
@@ -340,6 +366,7 @@ win_toggle_search(bool show, bool focus)
                              DEFAULT_QUALITY, FIXED_PITCH | FF_DONTCARE,
                              cfg.font.name);
     SendMessage(search_edit_wnd, WM_SETFONT, (WPARAM)search_font, 1);
+    SendMessage(search_count_wnd, WM_SETFONT, (WPARAM)search_font, 1);
 
     default_edit_proc = (WNDPROC)SetWindowLongPtrW(search_edit_wnd, GWLP_WNDPROC, (long)edit_proc);
 
@@ -359,6 +386,11 @@ win_toggle_search(bool show, bool focus)
                  pos_edit, margin,
                  edit_width, ctrl_height,
                  SWP_NOZORDER);
+    SetWindowPos(search_count_wnd, 0,
+                 pos_count, margin,
+                 count_width, ctrl_height,
+                 SWP_NOZORDER);
+    win_update_search_count();
     if (focus) {
       SendMessage(search_edit_wnd, EM_SETSEL, 0, -1);
       SetFocus(search_edit_wnd);
@@ -393,6 +425,26 @@ win_update_search(void)
   }
 }
 
+void
+win_update_search_count(void)
+{
+  if (!search_count_wnd) {
+    return;
+  }
+
+  char count[20] = "";
+  if (term.results.regex_mode && term.results.xquery_length && !term.results.rx) {
+    // invalid regular expression
+    strcpy(count, "?");
+  }
+  else if (term.results.xquery_length) {
+    // indicate a count in progress by a trailing "+"
+    sprintf(count, "%d%s", term.results.count,
+            term.results.counting ? "+" : "");
+  }
+  SetWindowTextA(search_count_wnd, count);
+}
+
 void
 win_paint_exclude_search(HDC dc)
 {
@@ -12,6 +12,7 @@ extern int SEARCHBAR_HEIGHT;
 extern bool win_search_visible(void);
 extern void win_open_search(void);
 extern void win_update_search(void);
+extern void win_update_search_count(void);
 extern void win_paint_exclude_search(HDC dc);
 
 #endif
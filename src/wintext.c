@@ -1532,6 +1532,8 @@ show_curchar_info(char tag)
 
 #define update_timer 16
 
+static void scroll_moves(bool invalidate);
+
 void
 do_update(void)
 {
@@ -1570,6 +1572,9 @@ do_update(void)
 
   show_curchar_info('u');
 
+  // move the window contents as the display has scrolled
+  scroll_moves(false);
+
   dc = GetDC(wnd);
 
   // horizontal scrolling of terminal view
@@ -1587,8 +1592,10 @@ do_update(void)
     tek_paint();
   else {
     term_paint();
+    win_paint_cmds();
     winimgs_paint();
   }
+  term_damage_clear();
 
   ReleaseDC(wnd, dc);
 
@@ -4805,6 +4812,27 @@ skip_drawing:;
     SetWorldTransform(dc, &old_xform);
 }
 
+/*
+ * Execute the render commands produced by term_paint.
+ */
+void
+win_paint_cmds(void)
+{
+  termpaint * tp = &term.paint;
+  for (int k = 0; k < tp->len; k++) {
+    paint_cmd * pc = &tp->cmds[k];
+    switch (pc->type) {
+      when PAINT_TEXT:
+        win_text(pc->x, pc->y, tp->text + pc->text, pc->len,
+                 pc->attr, tp->textattr + pc->text, pc->lattr,
+                 pc->has_rtl, pc->has_sea, pc->clearpad, pc->phase);
+      when PAINT_EMOJI:
+        win_emoji_show(pc->x, pc->y, pc->efn, pc->bufpoi, pc->buflen,
+                       pc->len, pc->lattr, pc->attr.attr & ATTR_ITALIC);
+    }
+  }
+}
+
 
 static HFONT
 font4(struct fontfam * ff, cattrflags attr)
@@ -5737,30 +5765,106 @@ win_reset_colours(void)
 }
 
 
+/*
+ * Invalidate the terminal cells of a window region, 
+ * rectangle by rectangle.
+ */
+static void
+invalidate_rgn(HRGN rgn)
+{
+  void invalidate_rect(RECT * r)
+  {
+    // better invalidate more than less; limited to text area in term_invalidate
+    term_invalidate(
+      (r->left - PADDING) / cell_width,
+      (r->top - PADDING - OFFSET) / cell_height,
+      (r->right - PADDING - 1) / cell_width,
+      (r->bottom - PADDING - OFFSET - 1) / cell_height
+    );
+  }
+
+  DWORD size = GetRegionData(rgn, 0, null);
+  RGNDATA * data = size ? malloc(size) : null;
+  if (data && GetRegionData(rgn, size, data) == size) {
+    RECT * rects = (RECT *)data->Buffer;
+    for (uint k = 0; k < data->rdh.nCount; k++)
+      invalidate_rect(&rects[k]);
+  }
+  else {
+    RECT r;
+    if (GetRgnBox(rgn, &r) != NULLREGION)
+      invalidate_rect(&r);
+  }
+  free(data);
+}
+
+/*
+ * Move the window contents as noted by the scroll moves of the 
+ * display damage, so the moved text does not need to be painted again.
+ * Moves that are not applied here are repainted by term_paint.
+ * The parts of the window that could not be moved (uncovered or obscured) 
+ * are invalidated; with invalidate, in the window update region.
+ */
+static void
+scroll_moves(bool invalidate)
+{
+  if (tek_mode || !term.damage.moves_len)
+    return;
+  // with horizontal scrolling, the search bar overlaying the text, 
+  // or a background image, the contents cannot simply be moved
+  if (horclip() || win_search_visible() || bgbrush_bmp
+#if CYGWIN_VERSION_API_MINOR >= 74
+      || bgbrush_img
+#endif
+     )
+    return;
+
+  HRGN rgn = CreateRectRgn(0, 0, 0, 0);
+  while (term.damage.moves_len) {
+    damage_move * m = &term.damage.moves[0];
+    RECT rc = {
+      .left = PADDING,
+      .top = OFFSET + PADDING + m->top * cell_height,
+      .right = PADDING + term.cols * cell_width,
+      .bottom = OFFSET + PADDING + m->bot * cell_height
+    };
+    if (ScrollWindowEx(wnd, 0, - m->lines * cell_height, &rc, &rc,
+                       rgn, null, invalidate ? SW_INVALIDATE : 0) == ERROR)
+      break;
+    term_display_moved();
+    if (!invalidate)
+      invalidate_rgn(rgn);
+  }
+  DeleteObject(rgn);
+}
+
 #define dont_debug_padding_background
 
 void
 win_paint(void)
 {
+  // move the window contents first, unless do_update will do that
+  if (update_state != UPDATE_PENDING)
+    scroll_moves(true);
+
+  HRGN rgn = CreateRectRgn(0, 0, 0, 0);
+  if (GetUpdateRgn(wnd, rgn, false) != ERROR)
+    invalidate_rgn(rgn);
+  DeleteObject(rgn);
+
   PAINTSTRUCT p;
   dc = BeginPaint(wnd, &p);
 
-  // better invalidate more than less; limited to text area in term_invalidate
-  term_invalidate(
-    (p.rcPaint.left - PADDING) / cell_width,
-    (p.rcPaint.top - PADDING - OFFSET) / cell_height,
-    (p.rcPaint.right - PADDING - 1) / cell_width,
-    (p.rcPaint.bottom - PADDING - OFFSET - 1) / cell_height
-  );
-
   //if (kb_trace) printf("[%ld] win_paint state %d (idl/blk/pnd)\n", mtime(), update_state);
   if (update_state != UPDATE_PENDING) {
     if (tek_mode)
       tek_paint();
     else {
       term_paint();
+      win_paint_cmds();
       winimgs_paint();
     }
+    term_damage_clear();
   }
 
   if (// check whether no background was configured and successfully loaded